@@ -47,13 +47,137 @@ ASCII32 ascii32;
 
 */
 /**************************************************************************/
-void ASCII32::begin(uint8_t radioCsPin, uint8_t radioSdnPin, HardwareSerial *serial, char *gpsBuf)
+void ASCII32::begin(uint8_t radioCsPin, uint8_t radioSdnPin, HardwareSerial *serial)
 {
     // init radio
     si4313.begin(radioCsPin, radioSdnPin);
 
     // init gps
-    gps_init(serial, gpsBuf);
+    gps_init(serial);
+}
+
+/**************************************************************************/
+/*!
+    Open the gps port at <baud>. Call after begin().
+*/
+/**************************************************************************/
+void ASCII32::gpsBegin(uint32_t baud)
+{
+    gps_begin(baud);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int ASCII32::gpsAvail()
+{
+    return gps_available();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::gpsUpdate()
+{
+    gps_update();
+    timebase_update(gps_getFix(), gps_rmc_edge());
+}
+
+/**************************************************************************/
+/*!
+    Start switching the gps to 115200 baud, RMC and GGA only, at 10 Hz.
+    The acks are checked by gpsUpdate(), so keep calling it and watch
+    gpsConfigState() for GPS_CFG_DONE or GPS_CFG_FAILED.
+*/
+/**************************************************************************/
+void ASCII32::gpsConfig()
+{
+    gps_config_start();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+byte ASCII32::gpsConfigState()
+{
+    return gps_config_state();
+}
+
+/**************************************************************************/
+/*!
+    Latest gps fix in binary, lat/lon in 1e-7 degrees and UTC in seconds
+    since 1970. Valid until the next gpsUpdate().
+*/
+/**************************************************************************/
+const gps_fix_t *ASCII32::gpsFix()
+{
+    return gps_getFix();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::gpsStandby()
+{
+    gps_standby();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::gpsPeriodic()
+{
+    gps_periodic();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::gpsNormal()
+{
+    gps_normal();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int ASCII32::gpsRxAvail()
+{
+    return gps_rx_available();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int ASCII32::gpsRxRead()
+{
+    return gps_rx_read();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::gpsRxStats(gps_rx_stats_t *stats, bool clear)
+{
+    gps_rx_stats(stats, clear);
 }
 
 /**************************************************************************/
@@ -79,6 +203,26 @@ uint8_t ASCII32::radioReadReg(uint8_t addr)
 /**************************************************************************/
 /*!
 
+*/
+/**************************************************************************/
+void ASCII32::radioBurstWrite(uint8_t addr, const uint8_t *data, uint8_t len)
+{
+    si4313.burstWrite(addr, data, len);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioBurstRead(uint8_t addr, uint8_t *data, uint8_t len)
+{
+    si4313.burstRead(addr, data, len);
+}
+
+/**************************************************************************/
+/*!
+
 */
 /**************************************************************************/
 void ASCII32::radioChangeFreq(uint16_t freq)
@@ -89,6 +233,68 @@ void ASCII32::radioChangeFreq(uint16_t freq)
 /**************************************************************************/
 /*!
 
+*/
+/**************************************************************************/
+void ASCII32::radioChangeFreqKhz(uint32_t khz)
+{
+    si4313.changeFreqKhz(khz);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioSetSettle(uint16_t stepUs, uint16_t bandUs)
+{
+    si4313.setSettle(stepUs, bandUs);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint16_t ASCII32::radioSetRbw(uint16_t rbw)
+{
+    return si4313.setRbw(rbw);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint16_t ASCII32::radioGetRbw()
+{
+    return si4313.getRbw();
+}
+
+/**************************************************************************/
+/*!
+    Call <idle> once per point of a blocking scan while the pll settles.
+    Sweeps can take seconds, so the sketch keeps the gps drained from
+    here.
+*/
+/**************************************************************************/
+void ASCII32::radioSetScanIdle(scan_idle_cb_t idle)
+{
+    si4313.setScanIdle(idle);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioSetAutoRbw(bool enable)
+{
+    si4313.setAutoRbw(enable);
+}
+
+/**************************************************************************/
+/*!
+
 */
 /**************************************************************************/
 int16_t ASCII32::radioGetDB()
@@ -99,6 +305,66 @@ int16_t ASCII32::radioGetDB()
 /**************************************************************************/
 /*!
 
+*/
+/**************************************************************************/
+void ASCII32::radioSetDetector(uint8_t mode, uint8_t samples, uint16_t dwellUs)
+{
+    si4313.setDetector(mode, samples, dwellUs);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int16_t ASCII32::radioMeasure()
+{
+    return si4313.measure();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int16_t ASCII32::radioCalibrate(uint16_t freq, int16_t refDB)
+{
+    return si4313.calibrate(freq, refDB);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int8_t ASCII32::radioGetCalOffset(uint8_t band)
+{
+    return si4313.getCalOffset(band);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioCalSave()
+{
+    si4313.calSave();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioCalClear()
+{
+    si4313.calClear();
+}
+
+/**************************************************************************/
+/*!
+
 */
 /**************************************************************************/
 uint8_t ASCII32::radioGetRssi()
@@ -115,3 +381,369 @@ uint32_t ASCII32::radioScan(uint16_t start, uint16_t stop, scan_t *data)
 {
     return si4313.scan(start, stop, data);
 }
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint32_t ASCII32::radioScanHop(uint16_t start, uint16_t stop, scan_t *data)
+{
+    return si4313.scanHop(start, stop, data);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint32_t ASCII32::radioScanKhz(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t maxPoints)
+{
+    return si4313.scanKhz(start, stop, step, db, maxPoints);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint16_t ASCII32::radioScanSweep(uint32_t start, uint32_t stop, uint16_t step, sweep_t *sw)
+{
+    return si4313.scan(start, stop, step, sw);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint16_t ASCII32::radioScanAdaptive(uint32_t start, uint32_t stop, uint16_t fineStep, uint16_t coarseStep, uint8_t thresh, sweep_t *sw)
+{
+    return si4313.scanAdaptive(start, stop, fineStep, coarseStep, thresh, sw);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint32_t ASCII32::radioScanStart(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, scan_cb_t done)
+{
+    return si4313.scanStart(start, stop, step, db, done);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool ASCII32::radioScanPoll()
+{
+    return si4313.scanPoll();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioScanStop()
+{
+    si4313.scanStop();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool ASCII32::radioScanBusy()
+{
+    return si4313.scanBusy();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint32_t ASCII32::radioScanProgress()
+{
+    return si4313.scanProgress();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioSleep(uint32_t ms, uint8_t irq)
+{
+    si4313.sleep(ms, irq);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool ASCII32::radioWakePending()
+{
+    return si4313.wakePending();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioWake()
+{
+    si4313.wake();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioShutdown()
+{
+    si4313.shutdown();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioPowerUp()
+{
+    si4313.powerUp();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint32_t ASCII32::radioRegsSaved()
+{
+    return si4313.getRegsSaved();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::radioClearRegsSaved()
+{
+    si4313.clearRegsSaved();
+}
+
+/**************************************************************************/
+/*!
+    Start a streaming sweep from <start> to <stop> kHz in <step> kHz
+    increments. The radio fills one fixed size chunk while the previous one
+    is consumed, so sweeps of any length run in constant RAM. Chunks are
+    either handed to <cb> from sweepPoll(), or if <cb> is NULL, fetched
+    with sweepNext() and returned with sweepRelease(). If both chunks are
+    full the radio waits for the consumer rather than dropping points.
+*/
+/**************************************************************************/
+bool ASCII32::sweepStart(uint32_t start, uint32_t stop, uint16_t step, sweep_cb_t cb)
+{
+    _swFill = 0;
+    _swRead = 0;
+    _swReady = 0;
+    _swWaiting = false;
+    _swNextStart = start;
+    _swStep = step;
+    _swCb = cb;
+
+    return si4313.scanStartChunked(start, stop, step, _swBuf[0], SWEEP_CHUNK, sweepChunkFull, NULL) != 0;
+}
+
+/**************************************************************************/
+/*!
+    Advance the streaming sweep and pass any full chunks to the callback.
+    Returns true while the sweep is running or chunks are still waiting.
+*/
+/**************************************************************************/
+bool ASCII32::sweepPoll()
+{
+    const int16_t *db;
+    uint32_t start;
+    uint16_t count;
+    bool busy = si4313.scanPoll();
+
+    if (_swCb)
+    {
+        while ((db = sweepNext(&start, &count)) != NULL)
+        {
+            _swCb(start, _swStep, db, count);
+            sweepRelease();
+        }
+    }
+    return busy || _swReady;
+}
+
+/**************************************************************************/
+/*!
+    Get the oldest full chunk, or NULL if none is ready. The chunk stays
+    valid until sweepRelease().
+*/
+/**************************************************************************/
+const int16_t *ASCII32::sweepNext(uint32_t *start, uint16_t *count)
+{
+    if (!_swReady)
+    {
+        return NULL;
+    }
+
+    *start = _swStart[_swRead];
+    *count = _swCount[_swRead];
+    return _swBuf[_swRead];
+}
+
+/**************************************************************************/
+/*!
+    Return the chunk from sweepNext() so the radio can fill it again.
+*/
+/**************************************************************************/
+void ASCII32::sweepRelease()
+{
+    if (!_swReady)
+    {
+        return;
+    }
+
+    _swRead ^= 1;
+    _swReady--;
+    if (_swWaiting)
+    {
+        _swWaiting = false;
+        si4313.scanResume(_swBuf[_swFill]);
+    }
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::sweepStop()
+{
+    si4313.scanStop();
+    _swReady = 0;
+    _swWaiting = false;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool ASCII32::monitorStart(uint8_t irq, const uint32_t *freq, uint8_t count, int16_t db10, uint16_t dwellMs)
+{
+    return si4313.monitorStart(irq, freq, count, db10, dwellMs);
+}
+
+/**************************************************************************/
+/*!
+    Collect a monitor trigger and tag it with the latest gps fix. The fix
+    is only as fresh as the last gpsUpdate(), gpsAge says how old it is.
+*/
+/**************************************************************************/
+bool ASCII32::monitorPoll(trigger_t *trig)
+{
+    if (!si4313.monitorPoll(&trig->sig))
+    {
+        return false;
+    }
+
+    trig->fix = *gps_getFix();
+    trig->gpsAge = gps_age();
+    timebase_utc(trig->sig.time, &trig->utc);
+    return true;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::monitorStop()
+{
+    si4313.monitorStop();
+}
+
+/**************************************************************************/
+/*!
+    Discipline the timebase to the gps PPS output on external interrupt
+    <ppsIrq>, or to the RMC arrival with TIMEBASE_NO_PPS. It follows the
+    gps from gpsUpdate().
+*/
+/**************************************************************************/
+void ASCII32::timeBegin(uint8_t ppsIrq)
+{
+    timebase_init(ppsIrq);
+}
+
+/**************************************************************************/
+/*!
+    UTC of the micros() time <us>, such as a sweep's t0. Returns false
+    until the timebase is synced.
+*/
+/**************************************************************************/
+bool ASCII32::timeUtc(unsigned long us, utc_t *utc)
+{
+    return timebase_utc(us, utc);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void ASCII32::timeStats(timebase_stats_t *st)
+{
+    timebase_stats(st);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool ASCII32::monitorBusy()
+{
+    return si4313.monitorBusy();
+}
+
+/**************************************************************************/
+/*!
+    Chunk handoff from the radio scan engine. Marks the chunk as full and
+    gives the radio the other buffer if the consumer has released it.
+*/
+/**************************************************************************/
+int16_t *ASCII32::sweepChunkFull(int16_t *db, uint32_t count)
+{
+    ASCII32 *self = &ascii32;
+    uint8_t b = self->_swFill;
+
+    self->_swCount[b] = count;
+    self->_swStart[b] = self->_swNextStart;
+    self->_swNextStart += count * self->_swStep;
+    self->_swReady++;
+    self->_swFill ^= 1;
+
+    if (self->_swReady < 2)
+    {
+        return self->_swBuf[self->_swFill];
+    }
+
+    self->_swWaiting = true;
+    return NULL;
+}
@@ -9,22 +9,110 @@
 
 #include "utility/si4313.h"
 #include "utility/gps.h"
+#include "utility/waterfall.h"
+#include "utility/timebase.h"
+#include "utility/sdlog.h"
+#include "utility/codec.h"
+#include "utility/frame.h"
+#include "utility/txq.h"
+
+#define SWEEP_CHUNK 32      // points per ping-pong buffer for streaming sweeps
+
+// called for each chunk of a streaming sweep. <start> is the frequency of
+// the first point in kHz.
+typedef void (*sweep_cb_t)(uint32_t start, uint16_t step, const int16_t *db, uint16_t count);
+
+// monitor trigger with the gps fix it happened at
+typedef struct
+{
+    mon_evt_t sig;
+    gps_fix_t fix;
+    unsigned long gpsAge;   // ms since the fix was received
+    utc_t utc;              // UTC of the radio interrupt, zero if the timebase isn't synced
+} trigger_t;
 
 class ASCII32
 {
 public:
-    void begin(uint8_t radioCsPin, uint8_t radioSdnPin, HardwareSerial *serial, char *gpsBuf);
+    void begin(uint8_t radioCsPin, uint8_t radioSdnPin, HardwareSerial *serial);
+    void gpsBegin(uint32_t baud);
     int gpsAvail();
     void gpsUpdate();
+    void gpsConfig();
+    byte gpsConfigState();
+    const gps_fix_t *gpsFix();
+    void gpsStandby();
+    void gpsPeriodic();
+    void gpsNormal();
+    int gpsRxAvail();
+    int gpsRxRead();
+    void gpsRxStats(gps_rx_stats_t *stats, bool clear);
     void radioWriteReg(uint8_t addr, uint8_t data);
     uint8_t radioReadReg(uint8_t addr);
+    void radioBurstWrite(uint8_t addr, const uint8_t *data, uint8_t len);
+    void radioBurstRead(uint8_t addr, uint8_t *data, uint8_t len);
     void radioChangeFreq(uint16_t freq);
+    void radioChangeFreqKhz(uint32_t khz);
+    void radioSetSettle(uint16_t stepUs, uint16_t bandUs);
+    void radioSetScanIdle(scan_idle_cb_t idle);
+    uint16_t radioSetRbw(uint16_t rbw);
+    uint16_t radioGetRbw();
+    void radioSetAutoRbw(bool enable);
     uint8_t radioGetRssi();
     int16_t radioGetDB();
+    void radioSetDetector(uint8_t mode, uint8_t samples, uint16_t dwellUs);
+    int16_t radioMeasure();
+    int16_t radioCalibrate(uint16_t freq, int16_t refDB);
+    int8_t radioGetCalOffset(uint8_t band);
+    void radioCalSave();
+    void radioCalClear();
     uint32_t radioScan(uint16_t start, uint16_t stop, scan_t *data);
+    uint32_t radioScanHop(uint16_t start, uint16_t stop, scan_t *data);
+    uint32_t radioScanKhz(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t maxPoints);
+    uint16_t radioScanSweep(uint32_t start, uint32_t stop, uint16_t step, sweep_t *sw);
+    uint16_t radioScanAdaptive(uint32_t start, uint32_t stop, uint16_t fineStep, uint16_t coarseStep, uint8_t thresh, sweep_t *sw);
+    uint32_t radioScanStart(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, scan_cb_t done);
+    bool radioScanPoll();
+    void radioScanStop();
+    bool radioScanBusy();
+    uint32_t radioScanProgress();
+    void radioSleep(uint32_t ms, uint8_t irq);
+    bool radioWakePending();
+    void radioWake();
+    void radioShutdown();
+    void radioPowerUp();
+    uint32_t radioRegsSaved();
+    void radioClearRegsSaved();
+
+    bool sweepStart(uint32_t start, uint32_t stop, uint16_t step, sweep_cb_t cb);
+    bool sweepPoll();
+    const int16_t *sweepNext(uint32_t *start, uint16_t *count);
+    void sweepRelease();
+    void sweepStop();
+
+    bool monitorStart(uint8_t irq, const uint32_t *freq, uint8_t count, int16_t db10, uint16_t dwellMs);
+    bool monitorPoll(trigger_t *trig);
+    void monitorStop();
+    bool monitorBusy();
+
+    void timeBegin(uint8_t ppsIrq);
+    bool timeUtc(unsigned long us, utc_t *utc);
+    void timeStats(timebase_stats_t *st);
 
 private:
+    static int16_t *sweepChunkFull(int16_t *db, uint32_t count);
 
+    // streaming sweep ping-pong buffers
+    int16_t _swBuf[2][SWEEP_CHUNK];
+    uint16_t _swCount[2];
+    uint32_t _swStart[2];
+    uint32_t _swNextStart;      // frequency of the first point in the buffer being filled
+    uint16_t _swStep;
+    uint8_t _swFill;            // buffer the radio is filling
+    uint8_t _swRead;            // oldest full buffer
+    uint8_t _swReady;           // number of full buffers waiting for the consumer
+    bool _swWaiting;            // radio paused because both buffers are full
+    sweep_cb_t _swCb;
 };
 
 extern ASCII32 ascii32;
@@ -0,0 +1,342 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "codec.h"
+
+/**************************************************************************/
+/*!
+    Write <val> as a varint to <out>, or just count it if <out> is NULL.
+    Returns the bytes it takes.
+*/
+/**************************************************************************/
+static uint16_t codecVarint(Print *out, uint32_t val)
+{
+    uint16_t n = 0;
+
+    do
+    {
+        if (out)
+        {
+            out->write((uint8_t)((val & 0x7F) | ((val > 0x7F) ? 0x80 : 0)));
+        }
+        val >>= 7;
+        n++;
+    } while (val);
+    return n;
+}
+
+/**************************************************************************/
+/*!
+    Write <len> bytes of <val> little endian, or just count them.
+*/
+/**************************************************************************/
+static uint16_t codecPut(Print *out, uint32_t val, uint8_t len)
+{
+    uint8_t i;
+
+    for (i=0; out && (i<len); i++)
+    {
+        out->write((uint8_t)(val >> (8 * i)));
+    }
+    return len;
+}
+
+/**************************************************************************/
+/*!
+    True if <sw> has to go as a keyframe.
+*/
+/**************************************************************************/
+static bool codecIsKey(const codec_t *c, const sweep_t *sw)
+{
+    return !c->valid || (c->sinceKey >= c->keyEvery) || (sw->start != c->start) ||
+           (sw->step != c->step) || (sw->count != c->count);
+}
+
+/**************************************************************************/
+/*!
+    Code <sw> as the next frame into <out>, or count its size if <out> is
+    NULL. The state isn't touched.
+*/
+/**************************************************************************/
+static uint16_t codecRun(const codec_t *c, const sweep_t *sw, Print *out)
+{
+    bool key = codecIsKey(c, sw);
+    uint16_t i, run = 0, n;
+    int16_t d;
+
+    n = codecPut(out, key ? CODEC_KEY : 0, 1);
+    n += codecPut(out, c->seq + 1, 1);
+    n += codecPut(out, sw->count, 2);
+    if (key)
+    {
+        n += codecPut(out, sw->start, 4);
+        n += codecPut(out, sw->step, 2);
+    }
+
+    for (i=0; i<sw->count; i++)
+    {
+        if (key)
+        {
+            d = (int16_t)sw->level[i] - ((i > 0) ? sw->level[i - 1] : 0);
+        }
+        else
+        {
+            d = (int16_t)sw->level[i] - c->prev[i];
+        }
+
+        if (d == 0)
+        {
+            run++;
+            continue;
+        }
+        if (run)
+        {
+            n += codecVarint(out, ((uint32_t)(run - 1) << 1) | 1);
+            run = 0;
+        }
+        n += codecVarint(out, (uint32_t)((d << 1) ^ (d >> 15)) << 1);
+    }
+    if (run)
+    {
+        n += codecVarint(out, ((uint32_t)(run - 1) << 1) | 1);
+    }
+    return n;
+}
+
+/**************************************************************************/
+/*!
+    Set up a coder. <prev> of <size> bytes holds the last sweep for the
+    encoder, a decoder doesn't need it and can pass NULL. A keyframe goes
+    out at least every <keyEvery> frames.
+*/
+/**************************************************************************/
+void codec_init(codec_t *c, uint8_t *prev, uint16_t size, uint8_t keyEvery)
+{
+    c->prev = prev;
+    c->size = prev ? size : 0;
+    c->keyEvery = keyEvery;
+    c->seq = 0;
+    codec_reset(c);
+}
+
+/**************************************************************************/
+/*!
+    Forget the last sweep, so the next frame is a keyframe.
+*/
+/**************************************************************************/
+void codec_reset(codec_t *c)
+{
+    c->valid = false;
+    c->sinceKey = 0;
+    c->count = 0;
+}
+
+/**************************************************************************/
+/*!
+    Bytes the next frame for <sw> will take.
+*/
+/**************************************************************************/
+uint16_t codec_size(const codec_t *c, const sweep_t *sw)
+{
+    return codecRun(c, sw, NULL);
+}
+
+/**************************************************************************/
+/*!
+    Code <sw> as the next frame to <out> and keep it as the last sweep.
+    Returns the bytes written.
+*/
+/**************************************************************************/
+uint16_t codec_write(codec_t *c, const sweep_t *sw, Print *out)
+{
+    bool key = codecIsKey(c, sw);
+    uint16_t n = codecRun(c, sw, out);
+
+    c->seq++;
+    c->sinceKey = key ? 1 : c->sinceKey + 1;
+    c->start = sw->start;
+    c->step = sw->step;
+    c->count = sw->count;
+    c->valid = (sw->count <= c->size);
+    if (c->valid)
+    {
+        memcpy(c->prev, sw->level, sw->count);
+    }
+    return n;
+}
+
+/**************************************************************************/
+/*!
+    Read a varint token, false if the input ran out.
+*/
+/**************************************************************************/
+static bool codecToken(codec_get_t get, void *ctx, uint32_t *val)
+{
+    uint8_t shift;
+    int b;
+
+    *val = 0;
+    for (shift=0; shift<28; shift+=7)
+    {
+        if ((b = get(ctx)) < 0)
+        {
+            return false;
+        }
+        *val |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**************************************************************************/
+/*!
+    Read <len> bytes little endian, false if the input ran out.
+*/
+/**************************************************************************/
+static bool codecGet(codec_get_t get, void *ctx, uint32_t *val, uint8_t len)
+{
+    uint8_t i;
+    int b;
+
+    *val = 0;
+    for (i=0; i<len; i++)
+    {
+        if ((b = get(ctx)) < 0)
+        {
+            return false;
+        }
+        *val |= (uint32_t)b << (8 * i);
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Decode the next frame from <get> into <sw>. A delta frame is applied
+    to the levels already in <sw>, so <sw> must hold the sweep the last
+    frame decoded to. Returns false, and waits for a keyframe, if a frame
+    was missed or the frame is bad or too long for <sw>.
+*/
+/**************************************************************************/
+bool codec_decode(codec_t *c, codec_get_t get, void *ctx, sweep_t *sw)
+{
+    uint32_t flags, seq, count, start, step, tok;
+    uint16_t i = 0, run;
+    uint8_t ref;
+    int16_t d;
+    bool key;
+
+    if (!codecGet(get, ctx, &flags, 1) || !codecGet(get, ctx, &seq, 1) || !codecGet(get, ctx, &count, 2))
+    {
+        c->valid = false;
+        return false;
+    }
+
+    key = flags & CODEC_KEY;
+    if (key)
+    {
+        if (!codecGet(get, ctx, &start, 4) || !codecGet(get, ctx, &step, 2))
+        {
+            c->valid = false;
+            return false;
+        }
+    }
+    else
+    {
+        start = c->start;
+        step = c->step;
+        if (!c->valid || (seq != (uint8_t)(c->seq + 1)) || (count != c->count))
+        {
+            c->valid = false;
+            return false;
+        }
+    }
+    if (count > sw->size)
+    {
+        c->valid = false;
+        return false;
+    }
+
+    while (i < count)
+    {
+        if (!codecToken(get, ctx, &tok))
+        {
+            c->valid = false;
+            return false;
+        }
+
+        if (tok & 1)
+        {
+            // unchanged points
+            run = (tok >> 1) + 1;
+            if (run > count - i)
+            {
+                c->valid = false;
+                return false;
+            }
+            for (; run; run--, i++)
+            {
+                if (key)
+                {
+                    sw->level[i] = (i > 0) ? sw->level[i - 1] : 0;
+                }
+            }
+            continue;
+        }
+
+        tok >>= 1;
+        d = (int16_t)(tok >> 1) ^ -(int16_t)(tok & 1);
+        ref = key ? ((i > 0) ? sw->level[i - 1] : 0) : sw->level[i];
+        sw->level[i++] = ref + d;
+    }
+
+    sw->start = start;
+    sw->step = step;
+    sw->count = count;
+    c->start = start;
+    c->step = step;
+    c->count = count;
+    c->seq = seq;
+    c->valid = true;
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include "sweep.h"
+
+// delta and run length coding of compact sweeps. a keyframe codes each
+// level against the one before it in the same sweep, a delta frame
+// against the same point in the previous sweep. differences are zig-zag
+// varints and a run of unchanged points is one varint, so a quiet band
+// costs a byte or two per run. the encoder sends a keyframe every
+// keyEvery sweeps, whenever the start, step or point count change, and
+// when the sweep is too long for its previous sweep buffer.
+//
+// frame: flags (1), seq (1), count (2), then start (4) and step (2) on
+// keyframes only, then the tokens. little endian. each token is a
+// varint, 7 bits a byte low first. an even token is a difference,
+// zig-zag coded in the upper bits. an odd one is a run of
+// (token >> 1) + 1 unchanged points.
+#define CODEC_KEY           0x01    // flags, keyframe
+#define CODEC_MAX_SIZE(n)   (10 + (2 * (uint32_t)(n)))
+
+// next byte for the decoder, or -1 if there's none
+typedef int (*codec_get_t)(void *ctx);
+
+typedef struct
+{
+    uint8_t *prev;          // encoder only, the last sweep's levels
+    uint16_t size;          // capacity of prev
+    uint32_t start;         // of the last sweep coded
+    uint16_t step;
+    uint16_t count;
+    uint8_t seq;
+    uint8_t keyEvery;
+    uint8_t sinceKey;       // frames since the last keyframe
+    bool valid;             // the last sweep is known, so a delta frame can follow
+} codec_t;
+
+void codec_init(codec_t *c, uint8_t *prev, uint16_t size, uint8_t keyEvery);
+void codec_reset(codec_t *c);
+uint16_t codec_size(const codec_t *c, const sweep_t *sw);
+uint16_t codec_write(codec_t *c, const sweep_t *sw, Print *out);
+bool codec_decode(codec_t *c, codec_get_t get, void *ctx, sweep_t *sw);
@@ -0,0 +1,225 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "frame.h"
+
+// codec output into the packet being built
+class FrameOut : public Print
+{
+    frame_t *_f;
+
+public:
+    FrameOut(frame_t *f) : _f(f) {}
+    virtual size_t write(uint8_t c);
+};
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+size_t FrameOut::write(uint8_t c)
+{
+    frame_put(_f, &c, 1);
+    return 1;
+}
+
+/**************************************************************************/
+/*!
+    Send the block filled so far and start the next one.
+*/
+/**************************************************************************/
+static void frameFlush(frame_t *f)
+{
+    f->buf[0] = f->code;
+    f->out->write(f->buf, f->code);
+    f->code = 1;
+}
+
+/**************************************************************************/
+/*!
+    COBS code one byte.
+*/
+/**************************************************************************/
+static void frameByte(frame_t *f, uint8_t c)
+{
+    if (c == 0)
+    {
+        frameFlush(f);
+        return;
+    }
+    f->buf[f->code++] = c;
+    if (f->code == FRAME_BLOCK)
+    {
+        frameFlush(f);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Set up the packet writer for <out>.
+*/
+/**************************************************************************/
+void frame_init(frame_t *f, Print *out)
+{
+    f->out = out;
+    f->seq = 0;
+    f->code = 1;
+}
+
+/**************************************************************************/
+/*!
+    Start a packet of <type>. The type and the next sequence number go
+    first.
+*/
+/**************************************************************************/
+void frame_begin(frame_t *f, uint8_t type)
+{
+    uint8_t hdr[2];
+
+    hdr[0] = type;
+    hdr[1] = f->seq++;
+
+    f->out->write((uint8_t)0);
+    f->crc = 0xFFFF;
+    f->code = 1;
+    frame_put(f, hdr, sizeof(hdr));
+}
+
+/**************************************************************************/
+/*!
+    Add <len> bytes of payload.
+*/
+/**************************************************************************/
+void frame_put(frame_t *f, const void *data, uint16_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    while (len--)
+    {
+        f->crc = frame_crc(f->crc, *p);
+        frameByte(f, *p++);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Add the CRC and send the rest of the packet and the delimiter.
+*/
+/**************************************************************************/
+void frame_end(frame_t *f)
+{
+    uint16_t crc = f->crc;
+
+    frameByte(f, crc);
+    frameByte(f, crc >> 8);
+    frameFlush(f);
+    f->out->write((uint8_t)0);
+}
+
+/**************************************************************************/
+/*!
+    Send <sw> as a FRAME_SWEEP packet with the gps <fix> and the UTC of
+    its first point.
+*/
+/**************************************************************************/
+void frame_sweep(frame_t *f, const sweep_t *sw, const gps_fix_t *fix)
+{
+    frame_sweep_t hdr;
+    utc_t utc;
+
+    timebase_utc(sw->t0, &utc);
+    hdr.start = sw->start;
+    hdr.step = sw->step;
+    hdr.count = sw->count;
+    hdr.sec = utc.sec;
+    hdr.us = utc.us;
+    hdr.dur = sw->t1 - sw->t0;
+    hdr.lat = fix->lat;
+    hdr.lon = fix->lon;
+    hdr.alt = fix->alt;
+    hdr.sats = fix->sats;
+    hdr.valid = fix->valid;
+    frame_sweep_hdr(f, &hdr, sw->level);
+}
+
+/**************************************************************************/
+/*!
+    Send a FRAME_SWEEP packet from a header already filled in, such as a
+    logged sweep's, and <hdr->count> levels.
+*/
+/**************************************************************************/
+void frame_sweep_hdr(frame_t *f, const frame_sweep_t *hdr, const uint8_t *level)
+{
+    frame_begin(f, FRAME_SWEEP);
+    frame_put(f, hdr, sizeof(*hdr));
+    frame_put(f, level, hdr->count);
+    frame_end(f);
+}
+
+/**************************************************************************/
+/*!
+    Code <sw> with <c> and send the codec frame as a FRAME_CODEC packet.
+    A packet that fails its CRC on the host costs the deltas up to the
+    next keyframe, the codec sequence number shows it.
+*/
+/**************************************************************************/
+void frame_codec(frame_t *f, codec_t *c, const sweep_t *sw)
+{
+    FrameOut out(f);
+
+    frame_begin(f, FRAME_CODEC);
+    codec_write(c, sw, &out);
+    frame_end(f);
+}
+
+/**************************************************************************/
+/*!
+    CRC-16 CCITT of <c> added to <crc>, polynomial 0x1021, MSB first.
+    Shifts instead of a table to save flash.
+*/
+/**************************************************************************/
+uint16_t frame_crc(uint16_t crc, uint8_t c)
+{
+    uint8_t x = (crc >> 8) ^ c;
+
+    x ^= x >> 4;
+    return (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+}
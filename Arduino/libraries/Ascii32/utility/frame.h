@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include "sweep.h"
+#include "gps.h"
+#include "timebase.h"
+#include "codec.h"
+
+// binary packets for the serial link. a packet is a type byte, a
+// sequence number, the payload and a CRC-16 (CCITT, 0xFFFF start) of all
+// of it, little endian. it goes out COBS coded, so it holds no zero
+// bytes, with a zero before and after it. text between packets is
+// skipped by the host, and a packet hit by noise fails the CRC. the
+// sequence number shows the host how many packets it missed.
+//
+// COBS splits the packet at each zero into blocks of at most 254 bytes,
+// each sent as a length byte and the data. that adds a byte per 254, and
+// each block goes to the port in one write.
+#define FRAME_BLOCK     255
+#define FRAME_SWEEP     0x01    // frame_sweep_t then <count> level bytes
+#define FRAME_CODEC     0x02    // a codec frame, see codec.h
+
+// most bytes a sweep packet of <n> points takes on the wire
+#define FRAME_SWEEP_SIZE(n) ((n) + 41 + (((n) + 38) / 254))
+
+// most bytes a codec packet with an <n> byte codec frame takes
+#define FRAME_CODEC_SIZE(n) ((n) + 7 + (((n) + 4) / 254))
+
+// sweep packet header, after the type and sequence number
+typedef struct
+{
+    uint32_t start;         // kHz
+    uint16_t step;          // kHz
+    uint16_t count;
+    uint32_t sec;           // UTC of the first point, 0 if the timebase isn't synced
+    uint32_t us;
+    uint32_t dur;           // us the points took
+    int32_t lat;            // gps fix as in gps_fix_t
+    int32_t lon;
+    int32_t alt;
+    uint8_t sats;
+    uint8_t valid;
+} __attribute__((packed)) frame_sweep_t;
+
+typedef struct
+{
+    Print *out;
+    uint16_t crc;
+    uint8_t seq;
+    uint8_t code;               // next free byte in buf, the block length code
+    uint8_t buf[FRAME_BLOCK];   // the COBS block being filled
+} frame_t;
+
+void frame_init(frame_t *f, Print *out);
+void frame_begin(frame_t *f, uint8_t type);
+void frame_put(frame_t *f, const void *data, uint16_t len);
+void frame_end(frame_t *f);
+void frame_sweep(frame_t *f, const sweep_t *sw, const gps_fix_t *fix);
+void frame_sweep_hdr(frame_t *f, const frame_sweep_t *hdr, const uint8_t *level);
+void frame_codec(frame_t *f, codec_t *c, const sweep_t *sw);
+uint16_t frame_crc(uint16_t crc, uint8_t c);
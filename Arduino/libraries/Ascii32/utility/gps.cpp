@@ -27,33 +27,158 @@
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include "GPS.h"
+#include <stdio.h>
+#include "gps.h"
 #include <limits.h>
 
+#if !GPS_UART
+#warning "GPS_UART is 0, gps bytes go through the core's 64 byte Serial1 buffer and are lost if gps_update() falls behind"
+#endif
+
+// NMEA parser states
+enum
+{
+  NMEA_IDLE = 0,    // waiting for '$'
+  NMEA_TYPE,        // talker and sentence type
+  NMEA_FIELD,       // data fields
+  NMEA_CK_HI,       // checksum digits after '*'
+  NMEA_CK_LO
+};
+
+// sentences that get parsed
+enum
+{
+  NMEA_NONE = 0,
+  NMEA_RMC,
+  NMEA_GGA,
+  NMEA_ACK          // PMTK001 command ack
+};
+
+#define NMEA_TYPE_SZ 7      // long enough for PMTK001
+#define GPS_SOF_SZ 8        // sentence start times kept by the rx isr, power of two
+#define NMEA_NO_NUM 0xFF    // field isn't parsed as a number
+
+#if GPS_STRINGS
+// text fields of the sentence being parsed
+typedef union
+{
+  struct
+  {
+    char utc[UTC_SZ];
+    char status[DEFAULT_SZ];
+    char lat[LAT_SZ];
+    char lat_hem[DEFAULT_SZ];
+    char lon[LON_SZ];
+    char lon_hem[DEFAULT_SZ];
+    char speed[SPD_SZ];
+    char course[CRS_SZ];
+    char date[DATE_SZ+1];
+  } rmc;
+  struct
+  {
+    char quality[DEFAULT_SZ];
+    char num_sat[NUM_SAT_SZ];
+    char precision[PRECISION_SZ];
+    char altitude[ALTITUDE_SZ];
+  } gga;
+} nmea_stage_t;
+#endif
+
 /* 'private' methods declarations */
-void parse_line_rmc(char **token);  // parse RMC sentence (from NMEA protocol)
-void parse_line_gga(char **token);  // parse GGA sentence (from NMEA protocol)
+static void gps_tx(char c);         // send a byte to the gps
+static void gps_send_P(const char *cmd);  // send a command line stored in flash
+static void gps_tx_flush();         // wait for the last byte to leave the uart
+static void config_send(byte state);  // send the command for a configuration step
+static void config_poll();          // check for the ack of the current step
+void parse_field_start();           // set up the parser for the next field
+void parse_field_end();             // store a numeric field in the staged fix
+void parse_commit();                // copy a verified sentence into the gps data
+#if GPS_STRINGS
 void parse_datetime();              // parse date and time into correct data struct
+#endif
 
 /* state variables */
 byte _updating;
 HardwareSerial* _serial;      // The serial port used by GPS
-gps_t _gps_data;              // GPS data structure
-char *_line;                  // buffer to receive new line from serial
-byte _index;                  // current character index
+gps_fix_t _fix;               // binary fix
 unsigned long _rx_time;       // Timestamp of received time
+#if GPS_STRINGS
+gps_t _gps_data;              // GPS data structure
+#endif
+
+/* receive ring buffer. the isr only moves the head and the parser only
+   moves the tail. */
+#if GPS_UART
+static volatile byte _rx_buf[GPS_RX_BUF_SZ];
+static volatile uint16_t _rx_head;
+static volatile uint16_t _rx_tail;
+
+/* micros() when each '$' arrived, tagged with its place in the ring so
+   the parser can match them up even if some were overwritten */
+typedef struct
+{
+  uint16_t pos;
+  unsigned long us;
+} gps_sof_t;
+
+static volatile gps_sof_t _sof[GPS_SOF_SZ];
+static volatile byte _sof_head;
+#endif
+static volatile uint16_t _rx_dropped;
+static volatile uint16_t _rx_overrun;
+static uint16_t _rx_peak;
+static uint32_t _baud;
+static unsigned long _sof_us;               // arrival of the '$' about to be parsed
+static unsigned long _sof_stage;            // arrival of the sentence being parsed
+static unsigned long _rmc_edge;             // arrival of the last committed RMC
+
+/* last command ack from the gps, filled in by the parser */
+static uint16_t _ack_cmd;
+static byte _ack_flag;
+static uint16_t _ack_cmd_stage;
+static byte _ack_flag_stage;
+
+/* high rate configuration */
+static byte _cfg_state;
+static byte _cfg_try;
+static bool _cfg_heard;                     // a sentence got through at the new baud rate
+static uint32_t _cfg_baud;                  // baud rate to go back to if it didn't
+static unsigned long _cfg_sent;
+
+/* parser state. fields go into a staged copy of the fix and are only
+   committed once the checksum matches, so a corrupted sentence never
+   leaves a half updated fix. */
+static byte _state;
+static byte _type;                          // sentence being parsed
+static char _type_buf[NMEA_TYPE_SZ];
+static byte _field;                         // current field number
+static byte _pos;                           // character position in the type or field
+static byte _cksum;                         // running xor of the sentence
+static byte _rx_cksum;                      // checksum sent with the sentence
+static gps_fix_t _fix_stage;
+static uint32_t _tod;                       // RMC time of day in ms
+static int32_t _num;                        // numeric value of the current field
+static byte _dec;                           // decimals to keep, or NMEA_NO_NUM
+static byte _frac;                          // decimals seen so far, 0xFF before the point
+static bool _neg;
+#if GPS_STRINGS
+static char *_dest;                         // where the current text field goes, NULL to skip it
+static byte _dest_sz;
+static nmea_stage_t _stage;
+#endif
 
 // Constructor
-// we need to provide the line buffer for RAM efficiency
-void gps_init(HardwareSerial *serial, char *line)
+void gps_init(HardwareSerial *serial)
 {
   _serial = serial; // Hardware Serial connection, supposed to be initialized
-  _index = 0;            // character counter initialization
   _updating = 1;    
-  _line = line;     // the character array for serial com buffering
+  _state = NMEA_IDLE;
 
   // set initial gps data to all zero
+  memset((void *)&_fix, 0, sizeof(gps_fix_t));
+#if GPS_STRINGS
   memset((void *)&_gps_data, 0, sizeof(gps_t));
+#endif
 }
 
 // Availability indicator
@@ -74,78 +199,699 @@ unsigned long gps_age()
     return (ULONG_MAX - _rx_time + now);
 }
 
-// Update routine
+// Open the gps port. With GPS_UART, USART1 is set up directly with the
+// rx interrupt feeding the ring buffer.
+void gps_begin(uint32_t baud)
+{
+  _baud = baud;
+#if GPS_UART
+  uint16_t ubrr = (((F_CPU / 4) / baud) - 1) / 2;
+  byte sreg = SREG;
+
+  cli();
+  UCSR1B = 0;
+  UCSR1A = (1<<U2X1);
+  UBRR1 = ubrr;
+  UCSR1C = (1<<UCSZ11) | (1<<UCSZ10);   // 8N1
+  _rx_head = 0;
+  _rx_tail = 0;
+  for (byte i=0; i<GPS_SOF_SZ; i++)
+    _sof[i].pos = 0xFFFF;
+  UCSR1B = (1<<RXEN1) | (1<<TXEN1) | (1<<RXCIE1);
+  SREG = sreg;
+#else
+  _serial->begin(baud);
+#endif
+}
+
+#if GPS_UART
+// Read the ring buffer head. It's two bytes so it can't be read while
+// the isr might be writing it.
+static uint16_t rx_head()
+{
+  uint16_t head;
+  byte sreg = SREG;
+
+  cli();
+  head = _rx_head;
+  SREG = sreg;
+  return head;
+}
+
+// USART1 receive. Queue the byte, or count it as dropped if the parser
+// hasn't kept up.
+ISR(USART1_RX_vect)
+{
+  byte stat = UCSR1A;
+  byte c = UDR1;
+  uint16_t next = (_rx_head + 1) & (GPS_RX_BUF_SZ - 1);
+
+  if (stat & ((1<<DOR1) | (1<<FE1)))
+    _rx_overrun++;
+
+  if (next == _rx_tail)
+  {
+    _rx_dropped++;
+    return;
+  }
+
+  // time the start of each sentence here, the parser may get to it
+  // much later
+  if (c == '$')
+  {
+    _sof[_sof_head].pos = _rx_head;
+    _sof[_sof_head].us = micros();
+    _sof_head = (_sof_head + 1) & (GPS_SOF_SZ - 1);
+  }
+  _rx_buf[_rx_head] = c;
+  _rx_head = next;
+}
+
+// Arrival time of the '$' at ring position <pos>. The newest match is
+// the right one, older ones are from a previous lap of the ring.
+static unsigned long sof_find(uint16_t pos)
+{
+  unsigned long us = micros();
+  byte i = _sof_head;
+  byte n, sreg = SREG;
+
+  cli();
+  for (n=0; n<GPS_SOF_SZ; n++)
+  {
+    i = (i - 1) & (GPS_SOF_SZ - 1);
+    if (_sof[i].pos == pos)
+    {
+      us = _sof[i].us;
+      break;
+    }
+  }
+  SREG = sreg;
+  return us;
+}
+#endif
+
+// Bytes waiting from the gps
+int gps_rx_available()
+{
+#if GPS_UART
+  return (rx_head() - _rx_tail) & (GPS_RX_BUF_SZ - 1);
+#else
+  return _serial->available();
+#endif
+}
+
+// Next byte from the gps, or -1 if there's none
+int gps_rx_read()
+{
+#if GPS_UART
+  byte c, sreg;
+
+  if (rx_head() == _rx_tail)
+    return -1;
+
+  c = _rx_buf[_rx_tail];
+  sreg = SREG;
+  cli();
+  _rx_tail = (_rx_tail + 1) & (GPS_RX_BUF_SZ - 1);
+  SREG = sreg;
+  return c;
+#else
+  return _serial->read();
+#endif
+}
+
+// Receive counters, optionally clearing them
+void gps_rx_stats(gps_rx_stats_t *stats, bool clear)
+{
+  byte sreg = SREG;
+
+  cli();
+  stats->dropped = _rx_dropped;
+  stats->overrun = _rx_overrun;
+  stats->peak = _rx_peak;
+  if (clear)
+  {
+    _rx_dropped = 0;
+    _rx_overrun = 0;
+    _rx_peak = 0;
+  }
+  SREG = sreg;
+}
+
+// Send an MTK command stored in flash. The checksum is worked out here
+// from what's between the '$' and the '*', whatever the command has
+// after the '*' is ignored.
+static void gps_send_P(const char *cmd)
+{
+  byte sum = 0, i, d;
+  char c;
+
+  while (((c = pgm_read_byte(cmd++)) != 0) && (c != '*'))
+  {
+    if (c != '$')
+      sum ^= c;
+    gps_tx(c);
+  }
+  gps_tx('*');
+  for (i=0; i<2; i++, sum <<= 4)
+  {
+    d = sum >> 4;
+    gps_tx((d < 10) ? '0' + d : 'A' + d - 10);
+  }
+  gps_tx('\r');
+  gps_tx('\n');
+}
+
+// Send a byte to the gps
+static void gps_tx(char c)
+{
+#if GPS_UART
+  while (!(UCSR1A & (1<<UDRE1)))
+    ;
+  // clear the transmit complete flag so gps_tx_flush() can wait on it
+  UCSR1A = (UCSR1A & ((1<<U2X1) | (1<<MPCM1))) | (1<<TXC1);
+  UDR1 = c;
+#else
+  _serial->write(c);
+#endif
+}
+
+// Wait for the last byte to be shifted out, so the baud rate can be
+// changed without cutting it off
+static void gps_tx_flush()
+{
+#if GPS_UART
+  while (!(UCSR1A & (1<<TXC1)))
+    ;
+#else
+  _serial->flush();
+#endif
+}
+
+// Update routine. Feeds whatever has been received to the parser. With
+// GPS_UART the whole backlog is parsed in one batch from a single
+// snapshot of the ring buffer head.
 void gps_update()
 {
+#if GPS_UART
+  uint16_t head = rx_head();
+  uint16_t tail = _rx_tail;
+  uint16_t used = (head - tail) & (GPS_RX_BUF_SZ - 1);
+  byte sreg;
+
+  if (used > _rx_peak)
+    _rx_peak = used;
 
-  char *tok[SYM_SZ] = {0};
-  int j = 0;
+  while (tail != head)
+  {
+    if (_rx_buf[tail] == '$')
+      _sof_us = sof_find(tail);
+    gps_parse(_rx_buf[tail]);
+    tail = (tail + 1) & (GPS_RX_BUF_SZ - 1);
+  }
 
+  sreg = SREG;
+  cli();
+  _rx_tail = tail;
+  SREG = sreg;
+#else
+  int used = _serial->available();
+
+  if (used > _rx_peak)
+    _rx_peak = used;
+
+  // without the rx isr a sentence can only be timed when it's parsed
   while (_serial->available())
   {
-    if (_index < LINE_SZ)
+    char c = _serial->read();
+
+    if (c == '$')
+      _sof_us = micros();
+    gps_parse(c);
+  }
+#endif
+
+  config_poll();
+}
+
+// Switch the gps to GPS_CFG_BAUD, RMC and GGA only, at 10 Hz. The baud
+// rate command isn't acked so it's sent blind and the port reopened at
+// the new rate. The other two steps are checked from gps_update() as
+// their acks come through the parser, and resent on a timeout, so
+// nothing here waits on the gps. If no sentence at all is heard at the
+// new rate the port goes back to the old one.
+void gps_config_start()
+{
+  _cfg_baud = _baud;
+  _cfg_heard = false;
+
+  gps_send_P(PSTR(MTK_BAUDRATE_115200));
+  gps_tx_flush();
+  gps_begin(GPS_CFG_BAUD);
+
+  _cfg_try = 0;
+  config_send(GPS_CFG_OUTPUT);
+}
+
+// Configuration progress, one of GPS_CFG_*
+byte gps_config_state()
+{
+  return _cfg_state;
+}
+
+// Send the command for a configuration step and start its ack timeout
+static void config_send(byte state)
+{
+  _cfg_state = state;
+  _cfg_try++;
+  _ack_cmd = 0;
+
+  if (state == GPS_CFG_OUTPUT)
+    gps_send_P(PSTR(MTK_SET_NMEA_OUTPUT_RMCGGA));
+  else
+    gps_send_P(PSTR(MTK_UPDATE_RATE_10HZ));
+  _cfg_sent = millis();
+}
+
+// Move the configuration on once the current step is acked. A refused
+// command is retried like a lost one.
+static void config_poll()
+{
+  uint16_t cmd;
+
+  if ((_cfg_state != GPS_CFG_OUTPUT) && (_cfg_state != GPS_CFG_RATE))
+    return;
+
+  cmd = (_cfg_state == GPS_CFG_OUTPUT) ? MTK_CMD_SET_NMEA_OUTPUT : MTK_CMD_UPDATE_RATE;
+  if ((_ack_cmd == cmd) && (_ack_flag == MTK_ACK_OK))
+  {
+    _cfg_try = 0;
+    if (_cfg_state == GPS_CFG_OUTPUT)
+      config_send(GPS_CFG_RATE);
+    else
+      _cfg_state = GPS_CFG_DONE;
+    return;
+  }
+
+  if ((_ack_cmd != cmd) && ((millis() - _cfg_sent) < GPS_CFG_TIMEOUT))
+    return;
+
+  if (_cfg_try < GPS_CFG_RETRY)
+  {
+    config_send(_cfg_state);
+    return;
+  }
+
+  _cfg_state = GPS_CFG_FAILED;
+  if (!_cfg_heard)
+    gps_begin(_cfg_baud);
+}
+
+// Byte at a time NMEA parser. Numbers are accumulated as fixed point as
+// the digits arrive and the checksum is worked out on the fly, so there
+// is no line buffer and no second pass. The sentence is committed only if
+// the checksum matches. Returns true when a sentence was committed.
+bool gps_parse(char c)
+{
+  byte hex;
+
+  // a '$' always starts a new sentence, whatever state we were in
+  if (c == '$')
+  {
+    _state = NMEA_TYPE;
+    _pos = 0;
+    _cksum = 0;
+    _sof_stage = _sof_us;
+    return false;
+  }
+
+  switch (_state)
+  {
+  case NMEA_TYPE:
+    _cksum ^= c;
+    if (c != ',')
     {
-      _line[_index] = _serial->read();
-      if (_line[_index] == '\n')
-      {
-        // set timestamp
-        _rx_time = millis();
+      if (_pos < NMEA_TYPE_SZ)
+        _type_buf[_pos++] = c;
+      else
+        _state = NMEA_IDLE;
+      break;
+    }
 
-        // terminate string with null character
-        _line[_index+1] = '\0';
-        
-        // reset character counter
-        _index=0;
+    // talker is ignored, only the sentence type matters
+    _type = NMEA_NONE;
+    if (_pos == 5)
+    {
+      if (memcmp_P(&_type_buf[2], PSTR("RMC"), 3) == 0)
+        _type = NMEA_RMC;
+      else if (memcmp_P(&_type_buf[2], PSTR("GGA"), 3) == 0)
+        _type = NMEA_GGA;
+    }
+    else if ((_pos == 7) && (memcmp_P(_type_buf, PSTR("PMTK001"), 7) == 0))
+    {
+      _type = NMEA_ACK;
+      _ack_flag_stage = MTK_ACK_INVALID;
+    }
+    if (_type == NMEA_NONE)
+    {
+      _state = NMEA_IDLE;
+      break;
+    }
 
-        // dump the raw GPS data
-        //Serial.print(_line);
+    if (_type != NMEA_ACK)
+    {
+      _updating = 1;
+      _fix_stage = _fix;
+#if GPS_STRINGS
+      memset(&_stage, 0, sizeof(_stage));
+#endif
+    }
+    _field = 1;
+    _state = NMEA_FIELD;
+    parse_field_start();
+    break;
 
-        // verify the line is valid NMEA sentence
-        int L = strlen(_line);
-        int valid_sentence = gps_verify_NMEA_sentence(_line, L-2); // -2 is for \r\n
+  case NMEA_FIELD:
+    if ((c == ',') || (c == '*'))
+    {
+      parse_field_end();
+      if (c == '*')
+      {
+        _state = NMEA_CK_HI;
+        break;
+      }
+      _cksum ^= c;
+      _field++;
+      parse_field_start();
+      break;
+    }
+    else if ((c < ' ') || (c > '~'))
+    {
+      // line ended without a checksum
+      _state = NMEA_IDLE;
+      break;
+    }
 
-        // if the sentence is a valide sentence, try to parse it
-        if (valid_sentence)
+    _cksum ^= c;
+    if (_dec != NMEA_NO_NUM)
+    {
+      if ((c >= '0') && (c <= '9'))
+      {
+        if (_frac == 0xFF)
         {
-          // tokenize line
-          char *string;
-
-          string = _line;
-
-          while ((tok[j++] = strsep(&string, ",")) != NULL)
-            ;
-
-          // reset the index variable for next run
-          j = 0;
-
-          // parse line and date/time and update gps struct
-          if (strcmp(tok[0], "$GPRMC") == 0)
-          {
-            parse_line_rmc(tok);
-            parse_datetime();
-          }
-          else if (strcmp(tok[0], "$GPGGA") == 0)
-          {
-             parse_line_gga(tok);
-          }
+          _num = (_num * 10) + (c - '0');
+        }
+        else if (_frac < _dec)
+        {
+          _num = (_num * 10) + (c - '0');
+          _frac++;
         }
-        
-        // clear the flag so that we know its okay to read the data
-        _updating = 0;
       }
-      else
+      else if (c == '.')
+      {
+        _frac = 0;
+      }
+      else if (c == '-')
       {
-        // still taking in data. increment index and make sure the updating flag is set
-        _updating = 1;
-        _index++;
+        _neg = true;
       }
+      else if (_pos == 0)
+      {
+        // single letter fields, status and hemisphere
+        _num = c;
+      }
+    }
+#if GPS_STRINGS
+    if (_dest && (_pos < _dest_sz - 1))
+    {
+      _dest[_pos] = c;
     }
+#endif
+    _pos++;
+    break;
+
+  case NMEA_CK_HI:
+  case NMEA_CK_LO:
+    if ((c >= '0') && (c <= '9'))
+      hex = c - '0';
+    else if ((c >= 'A') && (c <= 'F'))
+      hex = c - 'A' + 10;
     else
     {
-      _index = 0;
+      _state = NMEA_IDLE;
+      break;
+    }
+
+    if (_state == NMEA_CK_HI)
+    {
+      _rx_cksum = hex << 4;
+      _state = NMEA_CK_LO;
+      break;
+    }
+
+    _state = NMEA_IDLE;
+    if ((_rx_cksum | hex) == _cksum)
+    {
+      parse_commit();
+      return true;
     }
+    break;
+
+  default:
+    break;
   }
-  
+  return false;
+}
+
+// Set up the parser for the current field number. _dec is the number of
+// decimals a numeric field is scaled by.
+void parse_field_start()
+{
+  _pos = 0;
+  _num = 0;
+  _frac = 0xFF;
+  _neg = false;
+  _dec = NMEA_NO_NUM;
+
+  if (_type == NMEA_RMC)
+  {
+    switch (_field)
+    {
+    case 1: _dec = 3; break;    // utc hhmmss.sss
+    case 2: _dec = 0; break;    // status
+    case 3: _dec = 5; break;    // lat ddmm.mmmmm
+    case 4: _dec = 0; break;    // N/S
+    case 5: _dec = 5; break;    // lon dddmm.mmmmm
+    case 6: _dec = 0; break;    // E/W
+    case 7: _dec = 2; break;    // speed, knots
+    case 8: _dec = 2; break;    // course, degrees
+    case 9: _dec = 0; break;    // date ddmmyy
+    }
+  }
+  else if (_type == NMEA_GGA)
+  {
+    switch (_field)
+    {
+    case 6: _dec = 0; break;    // quality
+    case 7: _dec = 0; break;    // satellites
+    case 9: _dec = 2; break;    // altitude, m
+    }
+  }
+  else if (_type == NMEA_ACK)
+  {
+    switch (_field)
+    {
+    case 1: _dec = 0; break;    // command acked
+    case 2: _dec = 0; break;    // ack flag
+    }
+  }
+
+#if GPS_STRINGS
+  _dest = NULL;
+  if (_type == NMEA_RMC)
+  {
+    switch (_field)
+    {
+    case 1: _dest = _stage.rmc.utc;       _dest_sz = UTC_SZ;        break;
+    case 2: _dest = _stage.rmc.status;    _dest_sz = DEFAULT_SZ;    break;
+    case 3: _dest = _stage.rmc.lat;       _dest_sz = LAT_SZ;        break;
+    case 4: _dest = _stage.rmc.lat_hem;   _dest_sz = DEFAULT_SZ;    break;
+    case 5: _dest = _stage.rmc.lon;       _dest_sz = LON_SZ;        break;
+    case 6: _dest = _stage.rmc.lon_hem;   _dest_sz = DEFAULT_SZ;    break;
+    case 7: _dest = _stage.rmc.speed;     _dest_sz = SPD_SZ;        break;
+    case 8: _dest = _stage.rmc.course;    _dest_sz = CRS_SZ;        break;
+    case 9: _dest = _stage.rmc.date;      _dest_sz = DATE_SZ+1;     break;
+    }
+  }
+  else if (_type == NMEA_GGA)
+  {
+    switch (_field)
+    {
+    case 6: _dest = _stage.gga.quality;   _dest_sz = DEFAULT_SZ;    break;
+    case 7: _dest = _stage.gga.num_sat;   _dest_sz = NUM_SAT_SZ;    break;
+    case 8: _dest = _stage.gga.precision; _dest_sz = PRECISION_SZ;  break;
+    case 9: _dest = _stage.gga.altitude;  _dest_sz = ALTITUDE_SZ;   break;
+    }
+  }
+#endif
+}
+
+// Days since 1970-01-01 for a date in 2000 to 2099
+static uint32_t days_since_epoch(byte yy, byte mm, byte dd)
+{
+  static const uint16_t mdays[12] PROGMEM = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  uint32_t days;
+
+  // 10957 days from 1970 to 2000, plus leap days in the years before yy
+  days = 10957UL + (365UL * yy) + ((yy + 3) / 4) + pgm_read_word(&mdays[mm - 1]) + dd - 1;
+  if ((mm > 2) && ((yy & 3) == 0))
+    days++;
+  return days;
+}
+
+// Convert ddmm.mmmmm scaled by 1e5 to 1e-7 degrees. The minutes are
+// divided by 60 and scaled by 100, which is * 5 / 3.
+static int32_t dm_to_deg(int32_t dm)
+{
+  int32_t deg = dm / 10000000L;
+
+  return (deg * 10000000L) + ((((dm - (deg * 10000000L)) * 5) + 1) / 3);
+}
+
+// Store a numeric field in the staged fix
+void parse_field_end()
+{
+  byte dd, mm;
+
+  if (_dec == NMEA_NO_NUM)
+    return;
+
+  // pad out missing decimals so the scale is fixed
+  if (_frac == 0xFF)
+    _frac = 0;
+  for (; _frac < _dec; _frac++)
+    _num *= 10;
+  if (_neg)
+    _num = -_num;
+
+  if (_type == NMEA_RMC)
+  {
+    switch (_field)
+    {
+    case 1:
+      _tod = _num;
+      break;
+    case 2:
+      _fix_stage.valid = (_num == 'A');
+      break;
+    case 3:
+      _fix_stage.lat = dm_to_deg(_num);
+      break;
+    case 4:
+      if (_num == 'S')
+        _fix_stage.lat = -_fix_stage.lat;
+      break;
+    case 5:
+      _fix_stage.lon = dm_to_deg(_num);
+      break;
+    case 6:
+      if (_num == 'W')
+        _fix_stage.lon = -_fix_stage.lon;
+      break;
+    case 7:
+      _fix_stage.speed = _num;
+      break;
+    case 8:
+      _fix_stage.course = _num;
+      break;
+    case 9:
+      // hhmmss.sss to seconds and ms, ddmmyy to days
+      dd = _num / 10000;
+      mm = (_num / 100) % 100;
+      _fix_stage.ms = _tod % 1000;
+      _tod /= 1000;
+      _fix_stage.time = ((_tod / 10000) * 3600UL) + (((_tod / 100) % 100) * 60) + (_tod % 100);
+      if ((mm >= 1) && (mm <= 12))
+        _fix_stage.time += days_since_epoch(_num % 100, mm, dd) * 86400UL;
+      break;
+    }
+  }
+  else if (_type == NMEA_GGA)
+  {
+    switch (_field)
+    {
+    case 6:
+      _fix_stage.quality = _num;
+      break;
+    case 7:
+      _fix_stage.sats = _num;
+      break;
+    case 9:
+      _fix_stage.alt = _num;
+      break;
+    }
+  }
+  else if (_type == NMEA_ACK)
+  {
+    switch (_field)
+    {
+    case 1:
+      _ack_cmd_stage = _num;
+      break;
+    case 2:
+      _ack_flag_stage = _num;
+      break;
+    }
+  }
+}
+
+// Copy a verified sentence into the gps data
+void parse_commit()
+{
+  _cfg_heard = true;
+
+  if (_type == NMEA_ACK)
+  {
+    _ack_cmd = _ack_cmd_stage;
+    _ack_flag = _ack_flag_stage;
+    return;
+  }
+
+  _fix = _fix_stage;
+  if (_type == NMEA_RMC)
+    _rmc_edge = _sof_stage;
+
+#if GPS_STRINGS
+  static const char hex[] PROGMEM = "0123456789ABCDEF";
+
+  if (_type == NMEA_RMC)
+  {
+    memcpy(_gps_data.utc,       _stage.rmc.utc,       UTC_SZ);
+    memcpy(_gps_data.status,    _stage.rmc.status,    DEFAULT_SZ);
+    memcpy(_gps_data.lat,       _stage.rmc.lat,       LAT_SZ);
+    memcpy(_gps_data.lat_hem,   _stage.rmc.lat_hem,   DEFAULT_SZ);
+    memcpy(_gps_data.lon,       _stage.rmc.lon,       LON_SZ);
+    memcpy(_gps_data.lon_hem,   _stage.rmc.lon_hem,   DEFAULT_SZ);
+    memcpy(_gps_data.speed,     _stage.rmc.speed,     SPD_SZ);
+    memcpy(_gps_data.course,    _stage.rmc.course,    CRS_SZ);
+    memcpy(_gps_data.date,      _stage.rmc.date,      DATE_SZ+1);
+    _gps_data.checksum[0] = pgm_read_byte(&hex[_cksum >> 4]);
+    _gps_data.checksum[1] = pgm_read_byte(&hex[_cksum & 0x0F]);
+    _gps_data.checksum[2] = '\0';
+    parse_datetime();
+  }
+  else
+  {
+    memcpy(_gps_data.quality,   _stage.gga.quality,   DEFAULT_SZ);
+    memcpy(_gps_data.num_sat,   _stage.gga.num_sat,   NUM_SAT_SZ);
+    memcpy(_gps_data.precision, _stage.gga.precision, PRECISION_SZ);
+    memcpy(_gps_data.altitude,  _stage.gga.altitude,  ALTITUDE_SZ);
+  }
+#endif
+
+  // set timestamp and clear the flag so that we know its okay to read the data
+  _rx_time = millis();
+  _updating = 0;
 }
 
 // Compute checksum of input array
@@ -203,70 +949,28 @@ int gps_verify_NMEA_sentence(char *sentence, int L)
   return gps_checksum_match(sentence+1, L-4, sentence+L-2);
 }
 
+// micros() when the '$' of the last committed RMC arrived. With GPS_UART
+// it's taken in the rx interrupt, otherwise when the sentence was parsed.
+unsigned long gps_rmc_edge()
+{
+  return _rmc_edge;
+}
+
+// Return reference to the binary fix
+gps_fix_t *gps_getFix()
+{
+  return &_fix;
+}
+
+#if GPS_STRINGS
 // Return reference to GPS data structure
 gps_t *gps_getData() 
 { 
   return &_gps_data; 
 }
+#endif
 
-// Parse RMC sentence
-void parse_line_rmc(char **token)
-{
-  // put all that to zero
-  memset(&_gps_data.utc,        0,     UTC_SZ-1);
-  memset(&_gps_data.status,     0,     DEFAULT_SZ-1);
-  memset(&_gps_data.lat,        0,     LAT_SZ-1);
-  memset(&_gps_data.lat_hem,    0,     DEFAULT_SZ-1);
-  memset(&_gps_data.lon,        0,     LON_SZ-1);
-  memset(&_gps_data.lon_hem,    0,     DEFAULT_SZ-1);
-  memset(&_gps_data.speed,      0,     SPD_SZ-1);
-  memset(&_gps_data.course,     0,     CRS_SZ-1);
-  memset(&_gps_data.date,       0,     DATE_SZ-1);
-  memset(&_gps_data.checksum,   0,     CKSUM_SZ-1);
-
-  // now if token is not NULL, copy into the GPS data structure
-  if (token[1][0] != 0)
-    memcpy(&_gps_data.utc,        token[1],     UTC_SZ-1);
-  if (token[2][0] != 0)
-    memcpy(&_gps_data.status,     token[2],     DEFAULT_SZ-1);
-  if (token[3][0] != 0)
-    memcpy(&_gps_data.lat,        token[3],     LAT_SZ-1);
-  if (token[4][0] != 0)
-    memcpy(&_gps_data.lat_hem,    token[4],     DEFAULT_SZ-1);
-  if (token[5][0] != 0)
-    memcpy(&_gps_data.lon,        token[5],     LON_SZ-1);
-  if (token[6][0] != 0)
-    memcpy(&_gps_data.lon_hem,    token[6],     DEFAULT_SZ-1);
-  if (token[7][0] != 0)
-    memcpy(&_gps_data.speed,      token[7],     SPD_SZ-1);
-  if (token[8][0] != 0)
-    memcpy(&_gps_data.course,     token[8],     CRS_SZ-1);
-  if (token[9][0] != 0)
-    memcpy(&_gps_data.date,       token[9],     DATE_SZ-1);
-  if (token[10][0] != 0)
-    memcpy(&_gps_data.checksum,   token[10],    CKSUM_SZ-1);
-}
-
-// Parse GGA sentence
-void parse_line_gga(char **token)
-{
-    // set structure to zero
-    memset(&_gps_data.quality,    0, DEFAULT_SZ-1);
-    memset(&_gps_data.num_sat,    0, NUM_SAT_SZ-1);
-    memset(&_gps_data.precision,  0, PRECISION_SZ-1);
-    memset(&_gps_data.altitude,   0, ALTITUDE_SZ-1);
-    
-    // now copy data if present
-    if (token[6][0] != 0)
-      memcpy(&_gps_data.quality,    token[6], DEFAULT_SZ-1);
-    if (token[7][0] != 0)
-      memcpy(&_gps_data.num_sat,    token[7], NUM_SAT_SZ-1);
-    if (token[8][0] != 0)
-      memcpy(&_gps_data.precision,  token[8], PRECISION_SZ-1);
-    if (token[9][0] != 0)
-      memcpy(&_gps_data.altitude,   token[9], ALTITUDE_SZ-1);
-}
-
+#if GPS_STRINGS
 // Parse date and time from GPS and input in structure
 void parse_datetime()
 {
@@ -282,6 +986,7 @@ void parse_datetime()
     memcpy(_gps_data.datetime.month, &_gps_data.date[2], 2);
     memcpy(_gps_data.datetime.year, &_gps_data.date[4], 2);
 }
+#endif
 
 // Gets next gps line, or up to N characters
 // This routine is blocking
@@ -292,9 +997,9 @@ int gps_get_next_line(char *str, int N, int timeout)
   unsigned long now = millis();
   while (1)
   {
-    while (_serial->available())
+    while (gps_rx_available())
     {
-      str[i] = _serial->read();
+      str[i] = gps_rx_read();
       if (i == N || str[i] == '\n')
         goto out;
       i++;
@@ -319,7 +1024,6 @@ void gps_diagnostics()
 #define MAX_RETRY 5
 #define TMP_BUF_LEN 20
 
-  char msg[20];
   char tmp[TMP_BUF_LEN+1];
   char mtk_init_cmp[TMP_BUF_LEN+1];
   char mtk_sys_cmp[TMP_BUF_LEN+1];
@@ -333,12 +1037,11 @@ void gps_diagnostics()
   strcpy_P(mtk_sys_cmp, PSTR(MTK_SYS_MSG));
 
   // flush GPS serial
-  while (_serial->available())
-    _serial->read();
+  while (gps_rx_available())
+    gps_rx_read();
 
   // hot restart GPS to catch init message
-  strcpy_P(tmp, PSTR(MTK_HOT_RESTART));
-  _serial->println(tmp);
+  gps_send_P(PSTR(MTK_HOT_RESTART));
 
   while (r < MAX_RETRY && (mtk_init_stat == 0 || mtk_sys_stat == 0))
   {
@@ -370,32 +1073,8 @@ void gps_diagnostics()
         mtk_sys_stat = 1;
   }
 
-  strcpy_P(msg, PSTR("GPS type MTK,"));
-  Serial.print(msg);
-  if (mtk_init_stat)
-  {
-    strcpy_P(msg, PSTR("yes"));
-    Serial.println(msg);
-  }
-  else
-  {
-    strcpy_P(msg, PSTR("no"));
-    Serial.println(msg);
-  }
-
-  strcpy_P(msg, PSTR("GPS system startup,"));
-  Serial.print(msg);
-  if (mtk_sys_stat)
-  {
-    strcpy_P(msg, PSTR("yes"));
-    Serial.println(msg);
-  }
-  else
-  {
-    strcpy_P(msg, PSTR("no"));
-    Serial.println(msg);
-  }
-
+  printf_P(PSTR("GPS type MTK,%S\n"), mtk_init_stat ? PSTR("yes") : PSTR("no"));
+  printf_P(PSTR("GPS system startup,%S\n"), mtk_sys_stat ? PSTR("yes") : PSTR("no"));
 }
 
 /**************************************************************************/
@@ -410,3 +1089,25 @@ void gps_clear_flag()
 
 
 
+
+
+// Put the GPS in standby. It stops tracking and draws a few hundred uA
+// but keeps its ephemeris, so the next fix is a hot start.
+void gps_standby()
+{
+  gps_send_P(PSTR(MTK_STANDBY_MODE));
+  _updating = 1;
+}
+
+// Let the GPS duty cycle itself between tracking and standby
+void gps_periodic()
+{
+  gps_send_P(PSTR(MTK_PERIODIC_MODE));
+}
+
+// Back to full power tracking. Any byte wakes the GPS from standby so
+// this also ends standby.
+void gps_normal()
+{
+  gps_send_P(PSTR(MTK_NORMAL_MODE));
+}
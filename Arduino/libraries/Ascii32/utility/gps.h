@@ -70,12 +70,48 @@
 #define MTK_SET_NMEA_OUTPUT_ACK "$PMTK001,314,3*36"
 
 #define MTK_UPDATE_RATE_1HZ "$PMTK220,1000*1F"
-#define MTK_UPDATE_RATE_10HZ "$PMTK220,100*1F"
+#define MTK_UPDATE_RATE_10HZ "$PMTK220,100*2F"
 #define MTK_UPDATE_RATE_ACK "$PMTK001,220,3*30"
 
+// PMTK001 ack flags
+#define MTK_ACK_INVALID     0
+#define MTK_ACK_UNSUPPORTED 1
+#define MTK_ACK_FAILED      2
+#define MTK_ACK_OK          3
+
+// command numbers the acks refer to
+#define MTK_CMD_UPDATE_RATE     220
+#define MTK_CMD_SET_NMEA_OUTPUT 314
+
+// set to 1 to also keep the NMEA text fields in gps_t. the binary fix is
+// always kept.
+#ifndef GPS_STRINGS
+#define GPS_STRINGS 0
+#endif
+
+// set to 1 to have the gps module drive USART1 itself. received bytes are
+// queued from the rx interrupt into a ring buffer big enough to ride out
+// long sweeps, rather than the core's 64 byte buffer. this needs a core
+// where Serial1 and its interrupt live in their own file so they drop out
+// of the link when unused (1.6 and later), and the sketch must not touch
+// Serial1. on by default for those cores.
+#ifndef GPS_UART
+  #if ARDUINO >= 10600
+    #define GPS_UART 1
+  #else
+    #define GPS_UART 0
+  #endif
+#endif
+
+// gps receive ring buffer size, must be a power of two. RMC+GGA at
+// 10 Hz is about 1.5 kB/s so this rides out about 300 ms without a
+// gps_update(). a sweep takes longer than that, so gps_update() has to
+// be called from the scan too, see SI4313::setScanIdle().
+#ifndef GPS_RX_BUF_SZ
+#define GPS_RX_BUF_SZ 512
+#endif
+
 // GPS field size in characters
-#define LINE_SZ         100
-#define SYM_SZ          20
 #define GPS_TYPE_SZ     10
 #define UTC_SZ          10
 #define LAT_SZ          15
@@ -92,6 +128,45 @@
 #define MEAS_TYPE_SZ    20
 #define DEFAULT_SZ      2
 
+// binary fix, filled in directly by the parser
+typedef struct
+{
+    int32_t lat;            // 1e-7 degrees, north positive
+    int32_t lon;            // 1e-7 degrees, east positive
+    int32_t alt;            // cm above mean sea level
+    uint32_t time;          // UTC, seconds since 1970-01-01
+    uint16_t ms;            // milliseconds into the second
+    uint16_t speed;         // 0.01 knots
+    uint16_t course;        // 0.01 degrees true
+    uint8_t quality;        // GGA fix quality, 0 is no fix
+    uint8_t sats;           // satellites in use
+    uint8_t valid;          // RMC status, 1 if the position is valid
+} gps_fix_t;
+
+// high rate configuration, see gps_config_start()
+#define GPS_CFG_BAUD        115200
+#define GPS_CFG_TIMEOUT     1000    // ms to wait for each ack
+#define GPS_CFG_RETRY       3       // tries per command
+
+// configuration progress
+enum
+{
+  GPS_CFG_IDLE = 0,         // never started
+  GPS_CFG_OUTPUT,           // waiting for the RMC+GGA output ack
+  GPS_CFG_RATE,             // waiting for the 10 Hz update rate ack
+  GPS_CFG_DONE,
+  GPS_CFG_FAILED
+};
+
+// gps receive counters
+typedef struct
+{
+    uint16_t dropped;       // bytes lost because the ring buffer was full
+    uint16_t overrun;       // uart overrun or framing errors
+    uint16_t peak;          // most bytes waiting at once
+} gps_rx_stats_t;
+
+#if GPS_STRINGS
 // time structure
 typedef struct
 {
@@ -125,12 +200,24 @@ typedef struct
     char meas_type[MEAS_TYPE_SZ];
     date_time_t datetime;
 } gps_t;
+#endif
 
 // 'public' methods
-void gps_init(HardwareSerial *serial, char *line);
+void gps_init(HardwareSerial *serial);
+void gps_begin(uint32_t baud);
+int gps_rx_available();
+int gps_rx_read();
+void gps_rx_stats(gps_rx_stats_t *stats, bool clear);
 void gps_update();
+void gps_config_start();
+byte gps_config_state();
+bool gps_parse(char c);
 int gps_available();
+gps_fix_t *gps_getFix();
+unsigned long gps_rmc_edge();
+#if GPS_STRINGS
 gps_t *gps_getData();
+#endif
 char gps_checksum(char *s, int N);
 int gps_checksum_match(char *str, int L, char *chk);
 int gps_verify_NMEA_sentence(char *sentence, int L);
@@ -138,5 +225,8 @@ unsigned long gps_age();
 int gps_get_next_line(char *str, int N, int timeout);
 void gps_diagnostics();
 void gps_clear_flag();
+void gps_standby();
+void gps_periodic();
+void gps_normal();
 
 #endif /* GPS_H */
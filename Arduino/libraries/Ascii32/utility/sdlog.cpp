@@ -0,0 +1,677 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "sdlog.h"
+#include "timebase.h"
+
+#define SDLOG_BBOX_EMPTY 0x7FFFFFFFL
+#define SDLOG_MAX_CHAIN  255        // most records read back to find a keyframe
+
+// codec output straight into the staging buffer
+class SdlogOut : public Print
+{
+    sdlog_t *_log;
+
+public:
+    bool ok;
+
+    SdlogOut(sdlog_t *log) : _log(log), ok(true) {}
+    virtual size_t write(uint8_t c);
+};
+
+static bool sdlogPut(sdlog_t *log, const void *data, uint16_t len);
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+size_t SdlogOut::write(uint8_t c)
+{
+    ok &= sdlogPut(_log, &c, 1);
+    return 1;
+}
+
+/**************************************************************************/
+/*!
+    Codec input from the log file.
+*/
+/**************************************************************************/
+static int sdlogGet(void *ctx)
+{
+    return ((SdFile *)ctx)->read();
+}
+
+/**************************************************************************/
+/*!
+    Start the index staging block: its magic and number, and an empty
+    bounding box.
+*/
+/**************************************************************************/
+static void sdlogBboxClear(sdlog_t *log)
+{
+    sdlog_bbox_t *box = (sdlog_bbox_t *)log->ibuf;
+
+    memset(log->ibuf, 0, SDLOG_BLOCK);
+    box->magic = SDLOG_IDX_MAGIC;
+    box->seq = log->idxBlock;
+    box->minLat = SDLOG_BBOX_EMPTY;
+    box->maxLat = SDLOG_NO_FIX;
+    box->minLon = SDLOG_BBOX_EMPTY;
+    box->maxLon = SDLOG_NO_FIX;
+}
+
+/**************************************************************************/
+/*!
+    Last block records can use while the index holds <entries>. It's
+    below the record blocks already written once the log is full.
+*/
+/**************************************************************************/
+static uint32_t sdlogDataEnd(const sdlog_t *log, uint32_t entries)
+{
+    return log->bgnBlock + log->hdr.blocks - ((entries + SDLOG_ENTRIES - 1) / SDLOG_ENTRIES);
+}
+
+/**************************************************************************/
+/*!
+    Write the staging buffer out as the next record block and time it.
+*/
+/**************************************************************************/
+static bool sdlogFlush(sdlog_t *log)
+{
+    unsigned long t0 = micros(), us;
+
+    if (!log->card->writeData(log->buf))
+    {
+        log->failed = true;
+        return false;
+    }
+
+    us = micros() - t0;
+    if (us > log->maxUs)
+    {
+        log->maxUs = us;
+    }
+    log->block++;
+    log->fill = 0;
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Write the index staging block to its place from the end of the file.
+    The multi block write is stopped around it and picked up again where
+    it left off, which is the slowest write the log does.
+*/
+/**************************************************************************/
+static bool sdlogIndexFlush(sdlog_t *log, bool restart)
+{
+    unsigned long t0 = micros(), us;
+    uint32_t end = sdlogDataEnd(log, log->hdr.entries + 1);
+
+    if (!log->card->writeStop() ||
+        !log->card->writeBlock(log->bgnBlock + log->hdr.blocks - log->idxBlock, log->ibuf) ||
+        (restart && !log->card->writeStart(log->block, (end >= log->block) ? end - log->block + 1 : 1)))
+    {
+        log->failed = true;
+        return false;
+    }
+
+    us = micros() - t0;
+    if (us > log->maxUs)
+    {
+        log->maxUs = us;
+    }
+    log->idxBlock++;
+    log->ifill = 0;
+    sdlogBboxClear(log);
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Stage <len> bytes, writing out each block as it fills.
+*/
+/**************************************************************************/
+static bool sdlogPut(sdlog_t *log, const void *data, uint16_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint16_t n;
+
+    while (len)
+    {
+        n = SDLOG_BLOCK - log->fill;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(&log->buf[log->fill], p, n);
+        log->fill += n;
+        p += n;
+        len -= n;
+
+        if ((log->fill == SDLOG_BLOCK) && !sdlogFlush(log))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Add an index entry for the record staged at file offset <offset>, and
+    write the index block out if it's full.
+*/
+/**************************************************************************/
+static bool sdlogIndex(sdlog_t *log, const sdlog_rec_t *rec, uint32_t offset)
+{
+    sdlog_bbox_t *box = (sdlog_bbox_t *)log->ibuf;
+    sdlog_entry_t e;
+
+    e.sec = rec->sec;
+    e.lat = rec->valid ? rec->lat : SDLOG_NO_FIX;
+    e.lon = rec->valid ? rec->lon : SDLOG_NO_FIX;
+    e.offset = offset;
+
+    if (rec->valid)
+    {
+        box->minLat = min(box->minLat, e.lat);
+        box->maxLat = max(box->maxLat, e.lat);
+        box->minLon = min(box->minLon, e.lon);
+        box->maxLon = max(box->maxLon, e.lon);
+    }
+    memcpy(&log->ibuf[sizeof(sdlog_bbox_t) + (log->ifill * sizeof(e))], &e, sizeof(e));
+    log->ifill++;
+    log->hdr.entries++;
+
+    if (log->ifill == SDLOG_ENTRIES)
+    {
+        return sdlogIndexFlush(log, true);
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Create <name> as a contiguous file of <blocks> 512 byte blocks,
+    replacing any old one, and erase it. Starts the multi block write
+    with the header. Returns false if the card
+    couldn't do any of it.
+*/
+/**************************************************************************/
+bool sdlog_open(sdlog_t *log, SdFat *sd, const char *name, uint32_t blocks)
+{
+    uint32_t endBlock;
+
+    log->open = false;
+    log->failed = false;
+    log->maxUs = 0;
+    log->fill = 0;
+    log->ifill = 0;
+    memset(&log->hdr, 0, sizeof(log->hdr));
+
+    if (blocks < 3)
+    {
+        return false;
+    }
+    if (sd->exists(name) && !sd->remove(name))
+    {
+        return false;
+    }
+    if (!log->file.createContiguous(sd->vwd(), name, blocks * SDLOG_BLOCK))
+    {
+        return false;
+    }
+    if (!log->file.contiguousRange(&log->bgnBlock, &endBlock))
+    {
+        log->file.close();
+        return false;
+    }
+
+    log->hdr.magic = SDLOG_HDR_MAGIC;
+    log->hdr.version = SDLOG_VERSION;
+    log->hdr.blocks = blocks - 1;
+    log->idxBlock = 0;
+    sdlogBboxClear(log);
+
+    // some cards don't do erase, the writes are just slower then
+    log->card = sd->card();
+    log->card->erase(log->bgnBlock, endBlock);
+
+    if (!log->card->writeStart(log->bgnBlock, blocks))
+    {
+        log->file.close();
+        return false;
+    }
+
+    // header now, the totals go in when the log is closed
+    log->block = log->bgnBlock;
+    log->open = true;
+    memset(log->buf, 0, SDLOG_BLOCK);
+    memcpy(log->buf, &log->hdr, sizeof(log->hdr));
+    log->fill = SDLOG_BLOCK;
+    return sdlogFlush(log);
+}
+
+/**************************************************************************/
+/*!
+    Log the sweep <sw> with the gps <fix> and the UTC of its first point,
+    and index it. The levels are coded with <codec>, or stored raw if it's
+    NULL. At most one block write happens per 512 bytes logged, plus one
+    index block write every SDLOG_ENTRIES sweeps. The index entry is only
+    added once the whole record is staged, so it never points at a cut
+    off one. Returns false and counts the sweep as dropped if the log is
+    full, closed or a write fails. The codec is reset then, since the
+    frame it just coded never made it, so the next sweep is a keyframe.
+*/
+/**************************************************************************/
+bool sdlog_sweep(sdlog_t *log, const sweep_t *sw, const gps_fix_t *fix, codec_t *codec)
+{
+    sdlog_rec_t rec;
+    SdlogOut out(log);
+    utc_t utc;
+    uint32_t room = 0, offset, end;
+
+    // the record has to end below the index blocks its entry needs
+    rec.enc = (codec != NULL);
+    rec.len = sizeof(rec) + (codec ? codec_size(codec, sw) : sw->count);
+    end = sdlogDataEnd(log, log->hdr.entries + 1);
+    if (end >= log->block)
+    {
+        room = ((end - log->block + 1) * SDLOG_BLOCK) - log->fill;
+    }
+    if (!log->open || log->failed || (rec.len > room))
+    {
+        log->hdr.dropped++;
+        return false;
+    }
+
+    timebase_utc(sw->t0, &utc);
+    rec.magic = SDLOG_MAGIC;
+    rec.sec = utc.sec;
+    rec.us = utc.us;
+    rec.dur = sw->t1 - sw->t0;
+    rec.lat = fix->lat;
+    rec.lon = fix->lon;
+    rec.alt = fix->alt;
+    rec.sats = fix->sats;
+    rec.valid = fix->valid;
+    rec.start = sw->start;
+    rec.step = sw->step;
+    rec.count = sw->count;
+
+    offset = ((log->block - log->bgnBlock) * SDLOG_BLOCK) + log->fill;
+    if (sdlogPut(log, &rec, sizeof(rec)))
+    {
+        if (codec)
+        {
+            codec_write(codec, sw, &out);
+        }
+        else
+        {
+            out.ok = sdlogPut(log, sw->level, sw->count);
+        }
+    }
+    else
+    {
+        out.ok = false;
+    }
+
+    if (!out.ok || !sdlogIndex(log, &rec, offset))
+    {
+        if (codec)
+        {
+            codec_reset(codec);
+        }
+        log->hdr.dropped++;
+        return false;
+    }
+    log->hdr.records++;
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Pad out and write the last record block, write the last index block
+    and rewrite the header with the totals, then close the file.
+*/
+/**************************************************************************/
+bool sdlog_close(sdlog_t *log)
+{
+    bool ok = !log->failed;
+
+    if (!log->open)
+    {
+        return false;
+    }
+
+    // pad out the last block, or if the last record filled its block
+    // write a zero one, so the end is marked
+    if (!log->failed && ((log->fill > 0) || (log->block <= sdlogDataEnd(log, log->hdr.entries))))
+    {
+        memset(&log->buf[log->fill], 0, SDLOG_BLOCK - log->fill);
+        ok = sdlogFlush(log);
+    }
+
+    if (ok && (log->ifill > 0))
+    {
+        ok = sdlogIndexFlush(log, false);
+    }
+    else
+    {
+        ok &= log->card->writeStop();
+    }
+
+    if (ok)
+    {
+        memset(log->buf, 0, SDLOG_BLOCK);
+        memcpy(log->buf, &log->hdr, sizeof(log->hdr));
+        ok = log->card->writeBlock(log->bgnBlock, log->buf);
+    }
+
+    ok &= log->file.close();
+    log->open = false;
+    return ok;
+}
+
+/**************************************************************************/
+/*!
+    Record and index blocks used so far.
+*/
+/**************************************************************************/
+uint32_t sdlog_used(const sdlog_t *log)
+{
+    return ((log->block > log->bgnBlock) ? log->block - log->bgnBlock - 1 : 0) +
+           ((log->hdr.entries + SDLOG_ENTRIES - 1) / SDLOG_ENTRIES);
+}
+
+/**************************************************************************/
+/*!
+    Read index block <blk> into ibuf, unless it's already there. False
+    if it isn't an index block, or not that one.
+*/
+/**************************************************************************/
+static bool sdlogIndexLoad(sdlog_t *log, uint32_t blk)
+{
+    sdlog_bbox_t *box = (sdlog_bbox_t *)log->ibuf;
+
+    if (blk == log->idxBlock)
+    {
+        return true;
+    }
+
+    log->idxBlock = 0xFFFFFFFF;
+    if ((blk >= log->hdr.blocks) || !log->file.seekSet((log->hdr.blocks - blk) * SDLOG_BLOCK) ||
+        (log->file.read(log->ibuf, SDLOG_BLOCK) != SDLOG_BLOCK) ||
+        (box->magic != SDLOG_IDX_MAGIC) || (box->seq != blk))
+    {
+        return false;
+    }
+    log->idxBlock = blk;
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Open the log <name> for reading. It must be closed for writing. If
+    it wasn't closed cleanly the header has no entry count. Only full
+    index blocks were written then, numbered from 0, so the count is
+    found by binary search for the last one. Returns false if it isn't a
+    log.
+*/
+/**************************************************************************/
+bool sdlog_load(sdlog_t *log, const char *name)
+{
+    uint32_t lo, hi, mid;
+
+    if (log->open || !log->file.open(name, O_READ))
+    {
+        return false;
+    }
+    if ((log->file.read(&log->hdr, sizeof(log->hdr)) != sizeof(log->hdr)) ||
+        (log->hdr.magic != SDLOG_HDR_MAGIC) || (log->hdr.version != SDLOG_VERSION))
+    {
+        log->file.close();
+        return false;
+    }
+
+    log->idxBlock = 0xFFFFFFFF;
+    if (log->hdr.entries == 0)
+    {
+        lo = 0;
+        hi = log->hdr.blocks;
+        while (lo < hi)
+        {
+            mid = (lo + hi) / 2;
+            if (sdlogIndexLoad(log, mid))
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        log->hdr.entries = lo * SDLOG_ENTRIES;
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Close a log opened with sdlog_load().
+*/
+/**************************************************************************/
+void sdlog_unload(sdlog_t *log)
+{
+    log->file.close();
+}
+
+/**************************************************************************/
+/*!
+    Index entry <idx> of a loaded log.
+*/
+/**************************************************************************/
+bool sdlog_entry(sdlog_t *log, uint32_t idx, sdlog_entry_t *e)
+{
+    if ((idx >= log->hdr.entries) || !sdlogIndexLoad(log, idx / SDLOG_ENTRIES))
+    {
+        return false;
+    }
+
+    memcpy(e, &log->ibuf[sizeof(sdlog_bbox_t) + ((idx % SDLOG_ENTRIES) * sizeof(sdlog_entry_t))], sizeof(sdlog_entry_t));
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Index of the first sweep at or after UTC <sec>, or the entry count if
+    there's none. Binary search, so it reads about log2 of the index
+    blocks.
+*/
+/**************************************************************************/
+uint32_t sdlog_find(sdlog_t *log, uint32_t sec)
+{
+    sdlog_entry_t e;
+    uint32_t lo = 0, hi = log->hdr.entries, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (!sdlog_entry(log, mid, &e))
+        {
+            return log->hdr.entries;
+        }
+
+        if (e.sec < sec)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**************************************************************************/
+/*!
+    Next sweep from <idx> on taken within <radius> of <lat>, <lon>, all
+    in 1e-7 degrees, in a square. Index blocks whose bounding box is
+    outside the square are skipped without looking at their entries.
+    Returns false when there are no more.
+*/
+/**************************************************************************/
+bool sdlog_near(sdlog_t *log, int32_t lat, int32_t lon, int32_t radius, uint32_t *idx)
+{
+    sdlog_bbox_t *box = (sdlog_bbox_t *)log->ibuf;
+    sdlog_entry_t e;
+
+    while (*idx < log->hdr.entries)
+    {
+        if (!sdlogIndexLoad(log, *idx / SDLOG_ENTRIES))
+        {
+            return false;
+        }
+
+        if ((box->minLat > lat + radius) || (box->maxLat < lat - radius) ||
+            (box->minLon > lon + radius) || (box->maxLon < lon - radius))
+        {
+            *idx = ((*idx / SDLOG_ENTRIES) + 1) * SDLOG_ENTRIES;
+            continue;
+        }
+
+        sdlog_entry(log, *idx, &e);
+        if ((e.lat != SDLOG_NO_FIX) && (labs(e.lat - lat) <= radius) && (labs(e.lon - lon) <= radius))
+        {
+            return true;
+        }
+        (*idx)++;
+    }
+    return false;
+}
+
+/**************************************************************************/
+/*!
+    Read the header of record <idx>, leaving the file at its levels.
+*/
+/**************************************************************************/
+static bool sdlogRecord(sdlog_t *log, uint32_t idx, sdlog_rec_t *rec)
+{
+    sdlog_entry_t e;
+
+    return sdlog_entry(log, idx, &e) && log->file.seekSet(e.offset) &&
+           (log->file.read(rec, sizeof(*rec)) == sizeof(*rec)) && (rec->magic == SDLOG_MAGIC);
+}
+
+/**************************************************************************/
+/*!
+    Read record <idx>. The levels go into <sw> and t1 - t0 is the sweep
+    time. Raw levels are cut to fit. A coded record is decoded starting
+    from the keyframe before it, up to SDLOG_MAX_CHAIN records back.
+*/
+/**************************************************************************/
+bool sdlog_read(sdlog_t *log, uint32_t idx, sdlog_rec_t *rec, sweep_t *sw)
+{
+    codec_t c;
+    uint32_t k = idx;
+    uint16_t n;
+    int flags;
+
+    // back to the keyframe
+    while (true)
+    {
+        if (!sdlogRecord(log, k, rec))
+        {
+            return false;
+        }
+        if (!rec->enc)
+        {
+            break;
+        }
+        if ((flags = log->file.read()) < 0)
+        {
+            return false;
+        }
+        if (flags & CODEC_KEY)
+        {
+            break;
+        }
+        if ((k == 0) || (idx - k >= SDLOG_MAX_CHAIN))
+        {
+            return false;
+        }
+        k--;
+    }
+
+    if (!rec->enc)
+    {
+        // a raw record only ever starts its own chain
+        if (k != idx)
+        {
+            return false;
+        }
+        n = min(rec->count, sw->size);
+        if (log->file.read(sw->level, n) != n)
+        {
+            return false;
+        }
+        sw->start = rec->start;
+        sw->step = rec->step;
+        sw->count = n;
+    }
+    else
+    {
+        codec_init(&c, NULL, 0, 0);
+        for (; k <= idx; k++)
+        {
+            if (!sdlogRecord(log, k, rec) || !rec->enc || !codec_decode(&c, sdlogGet, &log->file, sw))
+            {
+                return false;
+            }
+        }
+    }
+
+    sw->t0 = 0;
+    sw->t1 = rec->dur;
+    return true;
+}
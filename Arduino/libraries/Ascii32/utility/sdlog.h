@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <SdFat.h>
+#include "sweep.h"
+#include "gps.h"
+#include "codec.h"
+
+// geotagged sweep log. the file is allocated contiguous and erased up
+// front, then written as raw 512 byte blocks in a multi block write, so
+// no FAT or cluster updates happen while logging.
+//
+// the file is a header block, then the record blocks growing up from
+// the front and the index blocks growing down from the end, so the
+// split between them follows the record size and the whole file can be
+// used whether the sweeps are big raw ones or small codec frames. the
+// log is full when the two meet.
+//
+// records are packed back to back through a one block staging buffer
+// and may straddle blocks. the levels are either raw or a codec frame,
+// in which case the sweeps back to the last keyframe are needed to
+// decode them. a record with a bad magic, zero padding included, ends
+// the records. each index block starts with a magic, its number and a
+// bounding box of the fixes in it, followed by SDLOG_ENTRIES entries,
+// one per sweep in the order logged. index block k is block k from the
+// end of the file. an index block is written out as soon as it fills,
+// and the header is rewritten with the totals when the log is closed.
+#define SDLOG_BLOCK         512
+#define SDLOG_MAGIC         0x5753      // "SW" on the card, starts each record
+#define SDLOG_HDR_MAGIC     0x4C323341  // "A32L" on the card
+#define SDLOG_IDX_MAGIC     0x58444E49  // "INDX" on the card, starts each index block
+#define SDLOG_VERSION       3
+#define SDLOG_ENTRIES       30          // index entries per block
+#define SDLOG_NO_FIX        (-2147483647L - 1)  // entry lat/lon for a sweep without a valid fix
+
+// header block
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint32_t blocks;        // record and index blocks, after the header
+    uint32_t entries;       // index entries, 0 if the log wasn't closed
+    uint32_t records;
+    uint32_t dropped;       // sweeps that weren't logged
+} __attribute__((packed)) sdlog_hdr_t;
+
+// record header, followed by <count> level bytes, or a codec frame if
+// enc is set. little endian.
+typedef struct
+{
+    uint16_t magic;
+    uint16_t len;           // bytes in the record, header included
+    uint32_t sec;           // UTC of the first point, 0 if the timebase wasn't synced
+    uint32_t us;
+    uint32_t dur;           // us the sweep took
+    int32_t lat;            // gps fix at the time of the sweep, as in gps_fix_t
+    int32_t lon;
+    int32_t alt;
+    uint8_t sats;
+    uint8_t valid;
+    uint8_t enc;            // levels are a codec frame
+    uint32_t start;         // kHz
+    uint16_t step;          // kHz
+    uint16_t count;
+} __attribute__((packed)) sdlog_rec_t;
+
+// index entry
+typedef struct
+{
+    uint32_t sec;           // as in the record
+    int32_t lat;            // SDLOG_NO_FIX without a valid fix
+    int32_t lon;
+    uint32_t offset;        // file offset of the record, 0 for an unused entry
+} __attribute__((packed)) sdlog_entry_t;
+
+// start of each index block. the box is empty if min > max.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;           // index block number, 0 at the end of the file
+    int32_t minLat;
+    int32_t maxLat;
+    int32_t minLon;
+    int32_t maxLon;
+} __attribute__((packed)) sdlog_bbox_t;
+
+typedef struct
+{
+    SdFile file;
+    Sd2Card *card;
+    sdlog_hdr_t hdr;
+    uint32_t bgnBlock;      // first block of the file
+    uint32_t block;         // next record block to write
+    uint32_t idxBlock;      // index block in ibuf, by number
+    uint16_t fill;          // bytes staged in buf
+    uint8_t ifill;          // entries staged in ibuf
+    bool open;
+    bool failed;            // a block write failed, nothing more is logged
+    uint32_t maxUs;         // longest block write
+    uint8_t buf[SDLOG_BLOCK];
+    uint8_t ibuf[SDLOG_BLOCK];
+} sdlog_t;
+
+bool sdlog_open(sdlog_t *log, SdFat *sd, const char *name, uint32_t blocks);
+bool sdlog_sweep(sdlog_t *log, const sweep_t *sw, const gps_fix_t *fix, codec_t *codec);
+bool sdlog_close(sdlog_t *log);
+uint32_t sdlog_used(const sdlog_t *log);
+bool sdlog_load(sdlog_t *log, const char *name);
+void sdlog_unload(sdlog_t *log);
+bool sdlog_entry(sdlog_t *log, uint32_t idx, sdlog_entry_t *e);
+uint32_t sdlog_find(sdlog_t *log, uint32_t sec);
+bool sdlog_near(sdlog_t *log, int32_t lat, int32_t lon, int32_t radius, uint32_t *idx);
+bool sdlog_read(sdlog_t *log, uint32_t idx, sdlog_rec_t *rec, sweep_t *sw);
@@ -38,10 +38,109 @@
 
 */
 /**************************************************************************/
+#include <stdio.h>
 #include "si4313.h"
 
 SI4313 si4313;
 
+// if filter bandwidths in 100 Hz units and the matching IFBW register
+// values, from the filter bandwidth table in the Si443x datasheet.
+// sorted from narrowest to widest.
+static const uint16_t rbwTable[] PROGMEM =
+{
+    26,   28,   31,   32,   37,   42,   45,
+    49,   54,   59,   61,   72,   82,   88,
+    95,   106,  115,  121,  142,  162,  175,
+    189,  210,  227,  240,  282,  322,  347,
+    377,  417,  452,  479,  562,  641,  692,
+    752,  832,  900,  953,  1121, 1279, 1379
+};
+
+static const uint8_t ifbwTable[] PROGMEM =
+{
+    0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57,
+    0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+    0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07
+};
+
+#define RBW_TABLE_SZ (sizeof(ifbwTable) / sizeof(ifbwTable[0]))
+
+// linear power relative to a reference, 65535 * 10^(-0.05 * d), for an rssi
+// d steps (0.5 dB each) below it. used by the rms detector. anything more
+// than 32 dB down contributes less than 0.1% and is dropped.
+static const uint16_t pwrTable[] PROGMEM =
+{
+    65535, 58408, 52056, 46395, 41350, 36853, 32845, 29273,
+    26090, 23253, 20724, 18470, 16462, 14671, 13076, 11654,
+    10387, 9257,  8250,  7353,  6554,  5841,  5206,  4640,
+    4135,  3685,  3285,  2927,  2609,  2325,  2072,  1847,
+    1646,  1467,  1308,  1165,  1039,  926,   825,   735,
+    655,   584,   521,   464,   413,   369,   328,   293,
+    261,   233,   207,   185,   165,   147,   131,   117,
+    104,   93,    83,    74,    66,    58,    52,    46
+};
+
+#define PWR_TABLE_SZ (sizeof(pwrTable) / sizeof(pwrTable[0]))
+
+// rssi to input level in tenths of dBm. piecewise fit of the rssi vs input
+// power curve in the SI4313-B1 datasheet v1.0, Figure 12: about 0.49 dB per
+// step through the linear region, getting steeper towards the noise floor
+// and towards saturation where the rssi flattens out.
+static const int16_t rssiTable[256] PROGMEM =
+{
+    -1322, -1307, -1293, -1279, -1266, -1253, -1241, -1229,
+    -1218, -1207, -1197, -1187, -1178, -1169, -1161, -1153,
+    -1146, -1139, -1132, -1127, -1121, -1116, -1111, -1106,
+    -1102, -1097, -1092, -1087, -1082, -1077, -1072, -1067,
+    -1062, -1058, -1053, -1048, -1043, -1038, -1033, -1028,
+    -1023, -1018, -1013, -1008, -1004, -999, -994, -989,
+    -984, -979, -974, -969, -964, -960, -955, -950,
+    -945, -940, -935, -930, -925, -920, -915, -910,
+    -906, -901, -896, -891, -886, -881, -876, -871,
+    -866, -862, -857, -852, -847, -842, -837, -832,
+    -827, -822, -817, -812, -808, -803, -798, -793,
+    -788, -783, -778, -773, -768, -764, -759, -754,
+    -749, -744, -739, -734, -729, -724, -719, -714,
+    -710, -705, -700, -695, -690, -685, -680, -675,
+    -670, -666, -661, -656, -651, -646, -641, -636,
+    -631, -626, -621, -616, -612, -607, -602, -597,
+    -592, -587, -582, -577, -572, -568, -563, -558,
+    -553, -548, -543, -538, -533, -528, -523, -518,
+    -514, -509, -504, -499, -494, -489, -484, -479,
+    -474, -470, -465, -460, -455, -450, -445, -440,
+    -435, -430, -425, -420, -416, -411, -406, -401,
+    -396, -391, -386, -381, -376, -371, -367, -362,
+    -357, -352, -347, -342, -337, -332, -327, -322,
+    -318, -313, -308, -303, -298, -293, -288, -283,
+    -278, -273, -269, -264, -259, -254, -249, -244,
+    -239, -234, -229, -224, -220, -215, -210, -205,
+    -200, -195, -190, -185, -180, -175, -171, -166,
+    -161, -156, -151, -146, -141, -136, -131, -125,
+    -119, -113, -107, -100, -93, -86, -79, -71,
+    -63, -55, -47, -38, -29, -20, -11, -2,
+    8, 18, 29, 39, 50, 61, 72, 84,
+    95, 107, 120, 132, 145, 158, 171, 185
+};
+
+// per band calibration offsets kept in eeprom. the magic byte marks the
+// offsets as valid.
+#define CAL_MAGIC 0xCA
+static uint8_t eeCalMagic EEMEM;
+static int8_t eeCal[CAL_BANDS] EEMEM;
+
+// registers the radio changes on its own, one bit per address. these
+// always go to the chip: device status, interrupt status, control 1
+// (sw reset self clears), io port, adc value, wake up timer value,
+// battery level, rssi, afc correction and the fifo.
+static const uint8_t volatileRegs[SI4313_REGS / 8] PROGMEM =
+{
+    0x9C, 0x40, 0x82, 0x09, 0x40, 0x08, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80
+};
+
 /**************************************************************************/
 /*!
 
@@ -54,12 +153,39 @@ void SI4313::begin(uint8_t csPin, uint8_t sdnPin)
 
     pinMode(_csPin, OUTPUT);
     digitalWrite(_csPin, HIGH);
+    _csPort = portOutputRegister(digitalPinToPort(_csPin));
+    _csMask = digitalPinToBitMask(_csPin);
+
+    _settleStepUs = SETTLE_STEP_US;
+    _settleBandUs = SETTLE_BAND_US;
+    _idle = NULL;
+    _rbw = 0;
+    _autoRbw = false;
+    _detMode = DET_SAMPLE;
+    _detSamples = 1;
+    _detDwellUs = 0;
+    _asState = SCAN_IDLE;
+    _monActive = false;
+    _asleep = false;
+    _regsSaved = 0;
+    cacheInvalidate();
+    calLoad();
 
     pinMode(_sdnPin, OUTPUT);
     digitalWrite(_sdnPin, LOW);
 
     SPI.begin();
+    init();
+}
 
+/**************************************************************************/
+/*!
+    Reset the radio and load the receiver configuration. The if filter is
+    put back to the last rbw that was set.
+*/
+/**************************************************************************/
+void SI4313::init()
+{
     // clear radio interrupt regs
     readReg(SI4313_INTPSTAT1);
     readReg(SI4313_INTPSTAT2);
@@ -83,13 +209,10 @@ void SI4313::begin(uint8_t csPin, uint8_t sdnPin)
     // FSK, 20ppm tx/rx xtal tolerance, Fc = 905 mhz
     // bitrate 9.6 kbps, AFC disabled, freq deviation = 70 khz 
     writeReg(SI4313_FREQSEL,      0x75);
+    _freqSel = 0x75;
     writeReg(SI4313_FREQCARR1,    0x4B);
     writeReg(SI4313_FREQCARR0,    0x00);
-    writeReg(SI4313_IFBW,         0xAE);
-    writeReg(SI4313_CLKRATIO,     0x39);
-    writeReg(SI4313_CLKOFFS2,     0x20);
-    writeReg(SI4313_CLKOFFS1,     0x68);
-    writeReg(SI4313_CLKOFFS0,     0xDC);
+    rbwDefault();
     writeReg(SI4313_CLKLPGAIN1,   0x00);
     writeReg(SI4313_CLKLPGAIN0,   0x10);
     writeReg(SI4313_AFCOVRD,      0x00);
@@ -102,6 +225,11 @@ void SI4313::begin(uint8_t csPin, uint8_t sdnPin)
     // enable receiver
     writeReg(SI4313_MODCTRL2, 0x02); // enable FSK
     writeReg(SI4313_CONTROL1, 0x05); // enable receiver & xtal
+
+    if (_rbw)
+    {
+        setRbw(_rbw);
+    }
 }
 
 /**************************************************************************/
@@ -111,47 +239,342 @@ void SI4313::begin(uint8_t csPin, uint8_t sdnPin)
 /**************************************************************************/
 void SI4313::changeFreq(uint16_t freq)
 {
-    uint16_t fb, fc, tmp;
+    changeFreqKhz(freq * 1000UL);
+}
+
+/**************************************************************************/
+/*!
+    Tune to <khz> with 1 kHz resolution.
+*/
+/**************************************************************************/
+void SI4313::changeFreqKhz(uint32_t khz)
+{
+    tune_t t;
+
+    t.step = 0;
+    if (tuneCalc(khz, &t))
+    {
+        tuneWrite(&t);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Calculate the band select and carrier for <khz> and the per step
+    increments for t->step. This is the only place that divides, so it's
+    called once per tune or once per sweep, not once per point.
+
+    Low band:  F = 10 MHz * (fb + 24 + fc/64000), 6.4 lsb per kHz
+    High band: F = 20 MHz * (fb + 24 + fc/64000), 3.2 lsb per kHz
+*/
+/**************************************************************************/
+bool SI4313::tuneCalc(uint32_t khz, tune_t *t)
+{
+    uint32_t tmp, num, dnum;
+
+    if (khz < 240000)
+    {
+        printf_P(PSTR("Frequencies below 240 MHz not supported.\n"));
+        return false;
+    }
+    else if (khz < 480000)
+    {
+        tmp = khz - 240000;
+
+        // calculate the freq band select and nominal carrier in fifths of an lsb
+        t->fb = (tmp / 10000) | 0x40;
+        num = (tmp % 10000) * 32;
+        dnum = (uint32_t)t->step * 32;
+    }
+    else if (khz < 960000)
+    {
+        tmp = khz - 480000;
+
+        // calculate the freq band select and nominal carrier in fifths of an lsb
+        t->fb = (tmp / 20000) | 0x60;   // enable sbsel & hbsel
+        num = (tmp % 20000) * 16;
+        dnum = (uint32_t)t->step * 16;
+    }
+    else
+    {
+        printf_P(PSTR("Frequencies above 960 MHz not supported.\n"));
+        return false;
+    }
+
+    t->khz = khz;
+    t->fc = num / 5;
+    t->rem = num % 5;
+    t->dq = dnum / 5;
+    t->dr = dnum % 5;
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Advance the tuning state by one step using only additions. Carrier
+    overflow carries into the band select. Crossing from the low band into
+    the high band changes the carrier scale so it's recalculated there.
+*/
+/**************************************************************************/
+void SI4313::tuneNext(tune_t *t)
+{
+    uint32_t fc;
+
+    t->khz += t->step;
+    if (!(t->fb & 0x20) && (t->khz >= 480000))
+    {
+        tuneCalc(t->khz, t);
+        return;
+    }
 
-    if (freq < 240)
+    fc = t->fc + t->dq;
+    t->rem += t->dr;
+    if (t->rem >= 5)
     {
-        Serial.println("Frequencies below 240 MHz not supported.");
+        t->rem -= 5;
+        fc++;
     }
-    else if (freq < 480)
+
+    while (fc >= 64000)
     {
-        tmp = freq - 240;
+        fc -= 64000;
+        t->fb++;
+    }
+    t->fc = fc;
+}
+
+/**************************************************************************/
+/*!
+    Write the tuning state to the radio and start the settle timer without
+    waiting for it.
+*/
+/**************************************************************************/
+void SI4313::tuneLoad(tune_t *t)
+{
+    uint8_t regs[3];    // FREQSEL, FREQCARR1, FREQCARR0
+
+    // write band select and carrier in a single burst
+    regs[0] = t->fb;
+    regs[1] = t->fc >> 8;
+    regs[2] = t->fc;
+    burstWrite(SI4313_FREQSEL, regs, sizeof(regs));
+
+    // band switches take longer to settle
+    settleStart(t->fb != _freqSel);
+    _freqSel = t->fb;
+}
+
+/**************************************************************************/
+/*!
+    Write the tuning state to the radio and wait for the pll to settle.
+*/
+/**************************************************************************/
+void SI4313::tuneWrite(tune_t *t)
+{
+    tuneLoad(t);
+    settleWait();
+}
+
+/**************************************************************************/
+/*!
+    Set the pll settle times in microseconds. <stepUs> is the wait for a
+    step inside the same band and <bandUs> the wait after a band switch.
+    Both are cut to SETTLE_MAX_US.
+*/
+/**************************************************************************/
+void SI4313::setSettle(uint16_t stepUs, uint16_t bandUs)
+{
+    _settleStepUs = min(stepUs, SETTLE_MAX_US);
+    _settleBandUs = min(bandUs, SETTLE_MAX_US);
+}
+
+/**************************************************************************/
+/*!
+    Call <idle> while the pll settles in a blocking scan, or NULL for
+    nothing. It shouldn't take much longer than a step settles, and it
+    mustn't use the radio.
+*/
+/**************************************************************************/
+void SI4313::setScanIdle(scan_idle_cb_t idle)
+{
+    _idle = idle;
+}
 
-        // write to freq band select reg
-        fb = tmp / 10;
-        fb |= 0x40;
-        writeReg(0x75, fb);
+/**************************************************************************/
+/*!
+    Set the resolution bandwidth. <rbw> is in 100 Hz units and the
+    narrowest filter at least that wide is used, or the widest filter if
+    none is. Returns the bandwidth actually programmed.
+*/
+/**************************************************************************/
+uint16_t SI4313::setRbw(uint16_t rbw)
+{
+    uint8_t i;
 
-        // calculate the nominal carrier freq & write to regs
-        fc = (tmp % 10) * 0x1900;
-        writeReg(0x76, fc >> 8);
-        writeReg(0x75, fc);
+    for (i=0; i<RBW_TABLE_SZ-1; i++)
+    {
+        if (pgm_read_word(&rbwTable[i]) >= rbw)
+        {
+            break;
+        }
     }
-    else if (freq < 960)
+    rbwWrite(i);
+    return _rbw;
+}
+
+/**************************************************************************/
+/*!
+    Set the resolution bandwidth to the widest filter that fits inside
+    <stepKhz>, so adjacent bins don't overlap and energy between bins isn't
+    missed. Falls back to the narrowest filter for very fine steps.
+    Returns the bandwidth programmed in 100 Hz units.
+*/
+/**************************************************************************/
+uint16_t SI4313::setRbwForStep(uint32_t stepKhz)
+{
+    uint8_t i;
+    uint32_t step = stepKhz * 10;
+
+    for (i=RBW_TABLE_SZ-1; i>0; i--)
     {
-        tmp = freq - 480;
+        if (pgm_read_word(&rbwTable[i]) <= step)
+        {
+            break;
+        }
+    }
+    rbwWrite(i);
+    return _rbw;
+}
+
+/**************************************************************************/
+/*!
+    Returns the current rbw in 100 Hz units, or 0 if the filter is still at
+    the spreadsheet setting from begin().
+*/
+/**************************************************************************/
+uint16_t SI4313::getRbw()
+{
+    return _rbw;
+}
+
+/**************************************************************************/
+/*!
+    When enabled, each scan picks the rbw from its step size.
+*/
+/**************************************************************************/
+void SI4313::setAutoRbw(bool enable)
+{
+    _autoRbw = enable;
+}
+
+/**************************************************************************/
+/*!
+    Program IFBW from table entry <idx> along with the clock recovery
+    oversampling ratio and nco offset, which depend on the filter's
+    decimation. The decimation rate is 2^ndec_exp.
+*/
+/**************************************************************************/
+void SI4313::rbwWrite(uint8_t idx)
+{
+    uint8_t ifbw, ndec;
+    uint16_t rxosr;
+    uint32_t ncoff;
+
+    ifbw = pgm_read_byte(&ifbwTable[idx]);
+    ndec = (ifbw >> 4) & 0x07;
+
+    // rxosr has 3 fractional bits. ncoff is scaled down by 100 to fit 32 bits.
+    rxosr = (500000UL * 8) / ((uint32_t)RX_DATA_RATE << ndec);
+    ncoff = ((uint32_t)(RX_DATA_RATE / 100) << (20 + ndec)) / 5000;
 
-        // write to freq band select reg
-        fb = (tmp/20);      // this is the actual fb we write
-        fb |= 0x60;         // enable sbsel & hbsel
-        writeReg(0x75, fb);
+    writeReg(SI4313_IFBW,       ifbw);
+    writeReg(SI4313_CLKRATIO,   rxosr);
+    writeReg(SI4313_CLKOFFS2,   ((rxosr >> 3) & 0xE0) | ((ncoff >> 16) & 0x0F));
+    writeReg(SI4313_CLKOFFS1,   ncoff >> 8);
+    writeReg(SI4313_CLKOFFS0,   ncoff);
+
+    _rbw = pgm_read_word(&rbwTable[idx]);
+}
+
+/**************************************************************************/
+/*!
+    Program the spreadsheet if filter and clock recovery settings from
+    init(). Leaves _rbw alone.
+*/
+/**************************************************************************/
+void SI4313::rbwDefault()
+{
+    writeReg(SI4313_IFBW,         0xAE);
+    writeReg(SI4313_CLKRATIO,     0x39);
+    writeReg(SI4313_CLKOFFS2,     0x20);
+    writeReg(SI4313_CLKOFFS1,     0x68);
+    writeReg(SI4313_CLKOFFS0,     0xDC);
+}
 
-        // calculate the nominal carrier freq & write to regs
-        fc = (tmp % 20) * 0xC80;    
-        writeReg(0x76, fc >> 8);
-        writeReg (0x77, fc);
+/**************************************************************************/
+/*!
+    Put back an rbw saved from getRbw(), including 0 for the spreadsheet
+    setting.
+*/
+/**************************************************************************/
+void SI4313::rbwRestore(uint16_t rbw)
+{
+    if (rbw)
+    {
+        setRbw(rbw);
     }
     else
     {
-        Serial.println("Frequencies above 960 MHz are not support.");
+        rbwDefault();
+        _rbw = 0;
     }
+}
+
+/**************************************************************************/
+/*!
+    Wait for the pll to settle after a retune.
+*/
+/**************************************************************************/
+void SI4313::settle(bool bandSwitch)
+{
+    settleStart(bandSwitch);
+    settleWait();
+}
+
+/**************************************************************************/
+/*!
+    Run the idle callback, then wait out the rest of the settle time.
+*/
+/**************************************************************************/
+void SI4313::settleWait()
+{
+    if (_idle)
+    {
+        _idle();
+    }
+    while (!settleDone());
+}
+
+/**************************************************************************/
+/*!
+    Start the settle timer after a retune.
+*/
+/**************************************************************************/
+void SI4313::settleStart(bool bandSwitch)
+{
+    _settleStart = micros();
+    _settleMinUs = bandSwitch ? _settleBandUs : _settleStepUs;
+}
 
-    // add short delay to allow pll to stabilize at new frequency
-    delay(1);
+/**************************************************************************/
+/*!
+    Check if the settle time for the kind of step has passed. It's a fixed
+    time, see SETTLE_STEP_US.
+*/
+/**************************************************************************/
+bool SI4313::settleDone()
+{
+    return (micros() - _settleStart) >= _settleMinUs;
 }
 
 /**************************************************************************/
@@ -162,29 +585,41 @@ void SI4313::changeFreq(uint16_t freq)
 /**************************************************************************/
 uint32_t SI4313::scan(uint16_t start, uint16_t stop, scan_t *data)
 {
-    uint16_t i, j;
+    uint16_t i;
+    tune_t t;
     scan_t *idx = data;
 
     if ((start < 240) | (stop > 960))
     {
-        Serial.println("Frequency not supported.");
+        printf_P(PSTR("Frequency not supported.\n"));
+        if (stop > 960)
+        {
+            stop = 960;
+        }
     }
 
-    for (i=start; i<stop; i += SCAN_STEP_SIZE)
+    if (_autoRbw)
     {
-        int16_t val;
-        
-        // change frequency and get signal strength in dB
-        changeFreq(i);
+        setRbwForStep(SCAN_STEP_SIZE * 1000);
+    }
 
-//        printf("%02X, %02X, %02X, %03d\n", readReg(0x75), readReg(0x76), readReg(0x77), readReg(0x26));
+    t.step = SCAN_STEP_SIZE * 1000;
+    if (!tuneCalc(start * 1000UL, &t))
+    {
+        return 0;
+    }
 
-        val = getDB();
+    for (i=start; i<stop; i += SCAN_STEP_SIZE)
+    {
+        // change frequency and get signal strength in dB
+        tuneWrite(&t);
 
         // write to data struct
         idx->freq = i;
-        idx->db = val;
+        idx->db = measure();
         idx++;
+
+        tuneNext(&t);
     }
 
     // return the number of data points from the scan
@@ -193,63 +628,1312 @@ uint32_t SI4313::scan(uint16_t start, uint16_t stop, scan_t *data)
 
 /**************************************************************************/
 /*!
-
+    Scan from <start> to <stop> kHz in <step> kHz increments. Only the
+    levels are stored in <db>, the frequency of point i is start + i*step.
+    The scan stops early once <maxPoints> are stored. Returns the number
+    of points.
 */
 /**************************************************************************/
-uint8_t SI4313::getRssi()
+uint32_t SI4313::scanKhz(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t maxPoints)
 {
-    return readReg(SI4313_RSSI);
+    uint32_t freq, count;
+    tune_t t;
+
+    if ((start < 240000) | (stop > 960000) | (step == 0))
+    {
+        printf_P(PSTR("Frequency not supported.\n"));
+        return 0;
+    }
+
+    if (_autoRbw)
+    {
+        setRbwForStep(step);
+    }
+
+    t.step = step;
+    if (!tuneCalc(start, &t))
+    {
+        return 0;
+    }
+
+    count = 0;
+    for (freq=start; (freq<stop) && (count<maxPoints); freq += step, count++)
+    {
+        tuneWrite(&t);
+        db[count] = measure();
+        tuneNext(&t);
+    }
+
+    return count;
 }
 
 /**************************************************************************/
 /*!
-
+    Scan from <start> to <stop> kHz in <step> kHz increments into the
+    compact sweep <sw>, one byte per point. The scan stops early if the
+    sweep is full. The sweep is stamped with micros() at its start and
+    end, and if <sw> has binUs, with the time spent on each point.
+    Returns the number of points.
 */
 /**************************************************************************/
-int16_t SI4313::getDB()
+uint16_t SI4313::scan(uint32_t start, uint32_t stop, uint16_t step, sweep_t *sw)
 {
-    uint16_t rssi = readReg(SI4313_RSSI);
-    int dB;
+    uint32_t count;
 
-    // these values are very roughly eyeballed and linearized from the
-    // graph in the SI4313-B1 datasheet v1.0, Figure 12.
-    dB = map(rssi, 8, 208, -118, -20);
-    return dB;
+    sw->start = start;
+    sw->step = step;
+    sw->count = 0;
+
+    if ((start < 240000) | (stop > 960000) | (step == 0) | (start >= stop))
+    {
+        printf_P(PSTR("Frequency not supported.\n"));
+        return 0;
+    }
+
+    if (_autoRbw)
+    {
+        setRbwForStep(step);
+    }
+
+    count = (stop - start + step - 1) / step;
+    sw->t0 = micros();
+    sw->count = scanLevels(start, step, sw->level, (count < sw->size) ? count : sw->size, sw->binUs);
+    sw->t1 = micros();
+    return sw->count;
 }
 
 /**************************************************************************/
 /*!
-
+    Measure <count> points from <start> kHz in <step> kHz increments as
+    compact levels into <level>. If <binUs> isn't NULL the us from the
+    start of each point to the next are put there. Returns the number of
+    points.
 */
 /**************************************************************************/
-uint8_t SI4313::readReg(uint8_t addr)
+uint16_t SI4313::scanLevels(uint32_t start, uint16_t step, uint8_t *level, uint16_t count, uint16_t *binUs)
 {
-    uint8_t val;
-    addr &= ~(1<<7);  // set bit 7 low for read
-    
-    cli();
-    digitalWrite(_csPin, LOW);
-    val = SPI.transfer(addr); // send address
-    val = SPI.transfer(0);  // receive data
-    digitalWrite(_csPin, HIGH);
-    sei();
-    
-    return val;
+    uint16_t i;
+    unsigned long last, now;
+    tune_t t;
+
+    t.step = step;
+    if (!tuneCalc(start, &t))
+    {
+        return 0;
+    }
+
+    last = micros();
+    for (i=0; i<count; i++)
+    {
+        tuneWrite(&t);
+        level[i] = rssiToLevel(detect());
+        tuneNext(&t);
+        if (binUs)
+        {
+            now = micros();
+            binUs[i] = now - last;
+            last = now;
+        }
+    }
+    return count;
 }
 
 /**************************************************************************/
 /*!
+    Adaptive scan from <start> to <stop> kHz. A coarse pass at <coarseStep>
+    with a wide rbw finds the bins more than <thresh> (0.5 dB units) above
+    the noise floor, then only those bins and their neighbours are rescanned
+    at <fineStep> with a narrow rbw. <coarseStep> must be a multiple of
+    <fineStep>.
+
+    The result in <sw> is a single sweep at <fineStep>. Points that weren't
+    rescanned hold the level of the coarse bin they fall in. The coarse
+    levels are kept at the front of the level array during the scan, so no
+    other buffer is needed. The sweep gets start and end times but no
+    per point times, most points aren't measured at their own frequency.
+    Returns the number of points actually measured, coarse and fine
+    together.
 
+    The two passes always pick their rbw from their step, whatever the
+    rbw or auto setting, since that's what makes the zoom work. The rbw
+    that was set is put back before returning.
 */
 /**************************************************************************/
-void SI4313::writeReg(uint8_t addr, uint8_t data)
+uint16_t SI4313::scanAdaptive(uint32_t start, uint32_t stop, uint16_t fineStep, uint16_t coarseStep, uint8_t thresh, sweep_t *sw)
 {
-    addr |= (1<<7);  // set bit 7 high for write
-    
-    cli();
-    digitalWrite(_csPin, LOW);
-    SPI.transfer(addr); // send address
-    SPI.transfer(data);  // receive data
-    digitalWrite(_csPin, HIGH);
-    sei();
+    uint8_t hot[ADAPT_MAX_COARSE / 8];
+    uint16_t nf, nc, r, k, i, lo, hi, done, measured;
+    uint16_t floorCnt = 0;
+    uint32_t sum = 0, floorSum = 0, mean;
+    uint8_t lvl, floorLvl;
+    uint16_t rbw = _rbw;
+
+    sw->start = start;
+    sw->step = fineStep;
+    sw->count = 0;
+
+    if ((start < 240000) | (stop > 960000) | (start >= stop) | (fineStep == 0) |
+        (coarseStep < fineStep) | ((coarseStep % fineStep) != 0))
+    {
+        printf_P(PSTR("Frequency not supported.\n"));
+        return 0;
+    }
+
+    // number of fine points and coarse bins. coarse bin k is centered on
+    // fine point k*r.
+    r = coarseStep / fineStep;
+    nf = min((stop - start + fineStep - 1) / fineStep, (uint32_t)sw->size);
+    nc = (nf + r - 1) / r;
+    if (nc > ADAPT_MAX_COARSE)
+    {
+        nc = ADAPT_MAX_COARSE;
+        nf = min((uint32_t)nc * r, (uint32_t)nf);
+    }
+
+    // coarse pass with a wide filter
+    setRbwForStep(coarseStep);
+    sw->t0 = micros();
+    measured = scanLevels(start, coarseStep, sw->level, nc, NULL);
+    if (measured != nc)
+    {
+        rbwRestore(rbw);
+        return 0;
+    }
+
+    // noise floor is the mean of the bins below the overall mean
+    for (k=0; k<nc; k++)
+    {
+        sum += sw->level[k];
+    }
+    mean = sum / nc;
+    for (k=0; k<nc; k++)
+    {
+        if (sw->level[k] <= mean)
+        {
+            floorSum += sw->level[k];
+            floorCnt++;
+        }
+    }
+    floorLvl = floorSum / floorCnt;
+
+    memset(hot, 0, sizeof(hot));
+    for (k=0; k<nc; k++)
+    {
+        if (sw->level[k] > floorLvl + thresh)
+        {
+            hot[k >> 3] |= 1 << (k & 7);
+        }
+    }
+
+    // spread each coarse level over the fine points around its center.
+    // working down from the top means coarse levels are read before their
+    // slots get overwritten.
+    for (k=nc; k-- > 0; )
+    {
+        lvl = sw->level[k];
+        lo = (k * r > r / 2) ? (k * r) - (r / 2) : 0;
+        hi = (k == nc - 1) ? nf : (k * r) + r - (r / 2);
+        for (i=lo; i<hi; i++)
+        {
+            sw->level[i] = lvl;
+        }
+    }
+    sw->count = nf;
+
+    // fine pass over the hot bins and their neighbours with a narrow filter
+    setRbwForStep(fineStep);
+    done = 0;
+    for (k=0; k<nc; k++)
+    {
+        if (!(hot[k >> 3] & (1 << (k & 7))))
+        {
+            continue;
+        }
+
+        lo = (k > 0) ? (k - 1) * r : 0;
+        hi = min((uint32_t)(k + 1) * r + 1, (uint32_t)nf);
+        if (lo < done)
+        {
+            lo = done;
+        }
+        if (lo < hi)
+        {
+            measured += scanLevels(start + ((uint32_t)lo * fineStep), fineStep, &sw->level[lo], hi - lo, NULL);
+            done = hi;
+        }
+    }
+
+    sw->t1 = micros();
+    rbwRestore(rbw);
+    return measured;
+}
+
+/**************************************************************************/
+/*!
+    Scan from <start> to <stop> MHz using the radio's frequency hopping
+    registers. The base frequency is programmed once per segment and each
+    step after that is a single write of the hop channel. Segments break
+    at band boundaries (10 MHz in the low band, 20 MHz in the high band)
+    since the hop offset can't carry across a band select.
+*/
+/**************************************************************************/
+uint32_t SI4313::scanHop(uint16_t start, uint16_t stop, scan_t *data)
+{
+    uint16_t freq, segEnd;
+    uint8_t ch;
+    scan_t *idx = data;
+
+    if ((start < 240) | (stop > 960))
+    {
+        printf_P(PSTR("Frequency not supported.\n"));
+        return 0;
+    }
+
+    if (_autoRbw)
+    {
+        setRbwForStep(SCAN_STEP_SIZE * 1000);
+    }
+
+    // hop step size is in 10 kHz units
+    writeReg(SI4313_FREQHOPSZ, SCAN_STEP_SIZE * 100);
+
+    freq = start;
+    while (freq < stop)
+    {
+        // find the end of the band this segment starts in
+        if (freq < 480)
+        {
+            segEnd = freq - ((freq - 240) % 10) + 10;
+        }
+        else
+        {
+            segEnd = freq - ((freq - 480) % 20) + 20;
+        }
+
+        if (segEnd > stop)
+        {
+            segEnd = stop;
+        }
+
+        // program the segment base at hop channel 0
+        writeReg(SI4313_FREQHOPSEL, 0);
+        changeFreq(freq);
+
+        for (ch=0; freq<segEnd; ch++, freq += SCAN_STEP_SIZE)
+        {
+            if (ch)
+            {
+                writeReg(SI4313_FREQHOPSEL, ch);
+                settle(false);
+            }
+
+            idx->freq = freq;
+            idx->db = measure();
+            idx++;
+        }
+    }
+
+    // leave the hop channel at zero so changeFreq tunes absolute frequencies
+    writeReg(SI4313_FREQHOPSEL, 0);
+
+    // return the number of data points from the scan
+    return idx - data;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint8_t SI4313::getRssi()
+{
+    return readReg(SI4313_RSSI);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int16_t SI4313::getDB()
+{
+    return rssiToDB(readReg(SI4313_RSSI));
+}
+
+/**************************************************************************/
+/*!
+    Signal level in tenths of dB.
+*/
+/**************************************************************************/
+int16_t SI4313::getDB10()
+{
+    return rssiToDB10(readReg(SI4313_RSSI));
+}
+
+/**************************************************************************/
+/*!
+    Convert an rssi reading to tenths of dB with the lookup table and the
+    calibration offset for the current band.
+*/
+/**************************************************************************/
+int16_t SI4313::rssiToDB10(uint8_t rssi)
+{
+    return (int16_t)pgm_read_word(&rssiTable[rssi]) + (_cal[calBand()] * 5);
+}
+
+/**************************************************************************/
+/*!
+    Convert an rssi reading to whole dB. x * 205 >> 11 is x / 10 to within
+    0.1% without a division.
+*/
+/**************************************************************************/
+int16_t SI4313::rssiToDB(uint8_t rssi)
+{
+    return ((int32_t)rssiToDB10(rssi) * 205 + 1024) >> 11;
+}
+
+/**************************************************************************/
+/*!
+    Convert an rssi reading to a compact sweep level, 0.5 dB steps above
+    LEVEL_FLOOR_DB. x * 205 >> 10 is x / 5 to within 0.1%.
+*/
+/**************************************************************************/
+uint8_t SI4313::rssiToLevel(uint8_t rssi)
+{
+    int32_t lvl = ((int32_t)(rssiToDB10(rssi) - (LEVEL_FLOOR_DB * 10)) * 205) >> 10;
+
+    return constrain(lvl, 0, 255);
+}
+
+/**************************************************************************/
+/*!
+    Lowest rssi reading that converts to at least <db10> tenths of dB in
+    the current band. The table is monotonic so this is a binary search.
+*/
+/**************************************************************************/
+uint8_t SI4313::dbToRssi(int16_t db10)
+{
+    uint16_t lo = 0, hi = 255, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        if (rssiToDB10(mid) < db10)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**************************************************************************/
+/*!
+    Index of the calibration offset for the band that's currently tuned.
+*/
+/**************************************************************************/
+uint8_t SI4313::calBand()
+{
+    uint8_t band = _freqSel & 0x1F;
+
+    if (_freqSel & 0x20)
+    {
+        band += 24;
+    }
+    return (band < CAL_BANDS) ? band : CAL_BANDS - 1;
+}
+
+/**************************************************************************/
+/*!
+    Calibrate the band containing <freq> MHz against a reference signal of
+    <refDB> tenths of dB fed into the receiver. The level is measured with
+    the current detector and the offset for that band is updated in RAM.
+    Returns the new offset in 0.5 dB units. Use calSave to keep it.
+*/
+/**************************************************************************/
+int16_t SI4313::calibrate(uint16_t freq, int16_t refDB)
+{
+    int16_t err;
+    uint8_t band;
+
+    changeFreq(freq);
+    band = calBand();
+
+    // the conversion includes the existing offset so only correct the error
+    err = refDB - rssiToDB10(detect());
+    err = _cal[band] + (err / 5);
+    _cal[band] = constrain(err, -128, 127);
+    return _cal[band];
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+int8_t SI4313::getCalOffset(uint8_t band)
+{
+    return (band < CAL_BANDS) ? _cal[band] : 0;
+}
+
+/**************************************************************************/
+/*!
+    Set the offset for <band> in 0.5 dB units.
+*/
+/**************************************************************************/
+void SI4313::setCalOffset(uint8_t band, int8_t offset)
+{
+    if (band < CAL_BANDS)
+    {
+        _cal[band] = offset;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Load the calibration offsets from eeprom. If they were never saved, the
+    offsets are all zero.
+*/
+/**************************************************************************/
+void SI4313::calLoad()
+{
+    if (eeprom_read_byte(&eeCalMagic) == CAL_MAGIC)
+    {
+        eeprom_read_block(_cal, eeCal, sizeof(_cal));
+    }
+    else
+    {
+        memset(_cal, 0, sizeof(_cal));
+    }
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::calSave()
+{
+    eeprom_update_block(_cal, eeCal, sizeof(_cal));
+    eeprom_update_byte(&eeCalMagic, CAL_MAGIC);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::calClear()
+{
+    memset(_cal, 0, sizeof(_cal));
+    calSave();
+}
+
+/**************************************************************************/
+/*!
+    Set the per bin detector. <mode> is one of the DET_* modes. Each bin
+    takes <samples> rssi readings, or if <dwellUs> is non-zero, reads for
+    that long (up to DET_MAX_SAMPLES readings).
+*/
+/**************************************************************************/
+void SI4313::setDetector(uint8_t mode, uint8_t samples, uint16_t dwellUs)
+{
+    _detMode = mode;
+    _detSamples = samples ? samples : 1;
+    _detDwellUs = dwellUs;
+}
+
+/**************************************************************************/
+/*!
+    Measure the signal level at the current frequency in dB using the
+    configured detector.
+*/
+/**************************************************************************/
+int16_t SI4313::measure()
+{
+    return rssiToDB(detect());
+}
+
+/**************************************************************************/
+/*!
+    Run the configured detector and return the result as an rssi value.
+*/
+/**************************************************************************/
+uint8_t SI4313::detect()
+{
+    det_t d;
+
+    detReset(&d);
+    while (!detAdd(&d, readReg(SI4313_RSSI)));
+    return detResult(&d);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::detReset(det_t *d)
+{
+    d->sum = 0;
+    d->hi = 0;
+    d->lo = 0xFF;
+    d->n = 0;
+    d->start = micros();
+}
+
+/**************************************************************************/
+/*!
+    Add one rssi reading to the bin. Returns true when the bin has all the
+    readings the detector wants. Accumulation is integer only. The rms
+    detector sums linear power relative to the highest reading seen so far
+    and rescales the sum when a new high arrives, so only one division is
+    needed per bin.
+*/
+/**************************************************************************/
+bool SI4313::detAdd(det_t *d, uint8_t rssi)
+{
+    uint8_t delta;
+
+    switch (_detMode)
+    {
+    case DET_AVG:
+        d->sum += rssi;
+        break;
+
+    case DET_RMS:
+        if (rssi > d->hi)
+        {
+            // move the reference up to the new high and rescale the sum
+            delta = rssi - d->hi;
+            d->sum = (delta < PWR_TABLE_SZ) ? ((d->sum >> 8) * pgm_read_word(&pwrTable[delta])) >> 8 : 0;
+            d->hi = rssi;
+        }
+        delta = d->hi - rssi;
+        if (delta < PWR_TABLE_SZ)
+        {
+            d->sum += pgm_read_word(&pwrTable[delta]);
+        }
+        break;
+    }
+
+    if (rssi > d->hi)
+    {
+        d->hi = rssi;
+    }
+    if (rssi < d->lo)
+    {
+        d->lo = rssi;
+    }
+    d->n++;
+
+    if ((_detMode == DET_SAMPLE) || (d->n >= DET_MAX_SAMPLES))
+    {
+        return true;
+    }
+    return _detDwellUs ? ((micros() - d->start) >= _detDwellUs) : (d->n >= _detSamples);
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+uint8_t SI4313::detResult(det_t *d)
+{
+    uint8_t delta;
+
+    switch (_detMode)
+    {
+    case DET_AVG:
+        return d->sum / d->n;
+
+    case DET_MIN:
+        return d->lo;
+
+    case DET_RMS:
+        // convert the mean power back to rssi steps below the high
+        d->sum /= d->n;
+        for (delta=0; (delta < PWR_TABLE_SZ) && (pgm_read_word(&pwrTable[delta]) > d->sum); delta++);
+        return d->hi - delta;
+
+    default:
+        // peak, or the only reading for a single sample
+        return d->hi;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Start a non-blocking scan from <start> to <stop> kHz in <step> kHz
+    increments into <db>, same layout as scanKhz. The scan is advanced by
+    calling scanPoll() from the main loop, and <done> is called when it
+    completes. Each poll does at most one step of work: a retune, a settle
+    check or one rssi reading, so the main loop keeps servicing the shell,
+    gps and SD card. The scan isn't run from a timer interrupt since the
+    SPI bus is shared with the SD card. Returns the number of points.
+*/
+/**************************************************************************/
+uint32_t SI4313::scanStart(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, scan_cb_t done)
+{
+    return scanStartChunked(start, stop, step, db, 0xFFFFFFFF, NULL, done);
+}
+
+/**************************************************************************/
+/*!
+    Start a non-blocking scan that fills <db> in chunks of <len> points.
+    When a chunk is full, <chunk> is called with it and returns the buffer
+    to fill next. If it returns NULL the scan pauses until scanResume is
+    called with a free buffer. The last, possibly partial, chunk is passed
+    to <chunk> before <done> is called.
+*/
+/**************************************************************************/
+uint32_t SI4313::scanStartChunked(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t len, scan_chunk_cb_t chunk, scan_cb_t done)
+{
+    if ((start < 240000) | (stop > 960000) | (step == 0) | (start >= stop) | (len == 0))
+    {
+        printf_P(PSTR("Frequency not supported.\n"));
+        return 0;
+    }
+
+    if (_autoRbw)
+    {
+        setRbwForStep(step);
+    }
+
+    _asTune.step = step;
+    if (!tuneCalc(start, &_asTune))
+    {
+        return 0;
+    }
+
+    _asBuf = db;
+    _asBufLen = len;
+    _asBufIdx = 0;
+    _asChunk = chunk;
+    _asDone = done;
+    _asIdx = 0;
+    _asCount = (stop - start + step - 1) / step;
+    _asState = SCAN_TUNE;
+    return _asCount;
+}
+
+/**************************************************************************/
+/*!
+    Continue a chunked scan that paused because no buffer was free.
+*/
+/**************************************************************************/
+void SI4313::scanResume(int16_t *db)
+{
+    if (_asState == SCAN_WAIT)
+    {
+        _asBuf = db;
+        _asState = SCAN_TUNE;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Advance the non-blocking scan. Returns true while the scan is running.
+*/
+/**************************************************************************/
+bool SI4313::scanPoll()
+{
+    switch (_asState)
+    {
+    case SCAN_TUNE:
+        tuneLoad(&_asTune);
+        _asState = SCAN_SETTLE;
+        break;
+
+    case SCAN_SETTLE:
+        if (settleDone())
+        {
+            detReset(&_asDet);
+            _asState = SCAN_MEASURE;
+        }
+        break;
+
+    case SCAN_MEASURE:
+        if (detAdd(&_asDet, readReg(SI4313_RSSI)))
+        {
+            _asBuf[_asBufIdx++] = rssiToDB(detResult(&_asDet));
+            _asIdx++;
+            if (_asIdx >= _asCount)
+            {
+                _asState = SCAN_IDLE;
+                if (_asChunk)
+                {
+                    _asChunk(_asBuf, _asBufIdx);
+                }
+                if (_asDone)
+                {
+                    _asDone(_asIdx);
+                }
+                return false;
+            }
+
+            tuneNext(&_asTune);
+            _asState = SCAN_TUNE;
+
+            // hand off a full chunk and get the next buffer
+            if (_asBufIdx >= _asBufLen)
+            {
+                _asBuf = _asChunk ? _asChunk(_asBuf, _asBufIdx) : NULL;
+                _asBufIdx = 0;
+                if (!_asBuf)
+                {
+                    _asState = SCAN_WAIT;
+                }
+            }
+        }
+        break;
+
+    case SCAN_WAIT:
+        break;
+
+    default:
+        return false;
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Abort the non-blocking scan. The completion callback isn't called.
+*/
+/**************************************************************************/
+void SI4313::scanStop()
+{
+    _asState = SCAN_IDLE;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool SI4313::scanBusy()
+{
+    return _asState != SCAN_IDLE;
+}
+
+/**************************************************************************/
+/*!
+    Number of points measured so far by the non-blocking scan.
+*/
+/**************************************************************************/
+uint32_t SI4313::scanProgress()
+{
+    return _asIdx;
+}
+
+/**************************************************************************/
+/*!
+    Wake on signal monitor. Parks the receiver on each of the <count>
+    channels in <freq> (kHz) for <dwellMs> in turn and lets the radio
+    compare the rssi against <db10> tenths of dB. When a signal crosses it
+    the radio pulls nIRQ low and external interrupt <irq> timestamps the
+    trigger, so nothing has to poll the rssi and the MCU can sleep until
+    something happens. Triggers are collected with monitorPoll(). The
+    monitor owns the receiver until monitorStop().
+*/
+/**************************************************************************/
+bool SI4313::monitorStart(uint8_t irq, const uint32_t *freq, uint8_t count, int16_t db10, uint16_t dwellMs)
+{
+    uint8_t i;
+
+    if ((count == 0) || (count > MON_MAX_CHANNELS))
+    {
+        printf_P(PSTR("Channel count not supported.\n"));
+        return false;
+    }
+
+    for (i=0; i<count; i++)
+    {
+        if ((freq[i] < 240000) || (freq[i] > 960000))
+        {
+            printf_P(PSTR("Frequency not supported.\n"));
+            return false;
+        }
+        _monFreq[i] = freq[i];
+    }
+
+    monitorStop();
+    _monCount = count;
+    _monChan = 0;
+    _monIrq = irq;
+    _monDB10 = db10;
+    _monDwellMs = dwellMs;
+    _monActive = true;
+
+    // only the rssi interrupt drives nIRQ
+    writeReg(SI4313_INTPENB1, 0);
+    writeReg(SI4313_INTPENB2, 1<<BIT_ENRSSI);
+    monitorTune();
+    attachInterrupt(_monIrq, monitorIsr, FALLING);
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Check for a trigger and move to the next channel once the dwell time is
+    up. Returns true and fills in <evt> if the radio interrupt fired. After
+    a trigger the monitor stays on the channel until the level drops below
+    the threshold again, so a long transmission is reported once.
+*/
+/**************************************************************************/
+bool SI4313::monitorPoll(mon_evt_t *evt)
+{
+    uint8_t stat[2];
+
+    if (!_monActive)
+    {
+        return false;
+    }
+
+    if (_monHit)
+    {
+        // nIRQ stays low until the status is read, so the isr can't
+        // update the time under us here
+        evt->time = _monTime;
+        burstRead(SI4313_INTPSTAT1, stat, 2);
+        _monHit = false;
+        _monArmed = false;
+
+        if (stat[1] & (1<<BIT_IRSSI))
+        {
+            evt->freq = _monFreq[_monChan];
+            evt->db10 = getDB10();
+            return true;
+        }
+    }
+
+    if (!_monArmed)
+    {
+        if (readReg(SI4313_RSSI) >= _monThresh)
+        {
+            return false;
+        }
+        monitorArm();
+    }
+
+    if ((_monCount > 1) && ((millis() - _monHop) >= _monDwellMs))
+    {
+        if (++_monChan >= _monCount)
+        {
+            _monChan = 0;
+        }
+        monitorTune();
+    }
+    return false;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::monitorStop()
+{
+    if (!_monActive)
+    {
+        return;
+    }
+
+    detachInterrupt(_monIrq);
+    writeReg(SI4313_INTPENB2, 0);
+    readReg(SI4313_INTPSTAT1);
+    readReg(SI4313_INTPSTAT2);
+    _monActive = false;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+bool SI4313::monitorBusy()
+{
+    return _monActive;
+}
+
+/**************************************************************************/
+/*!
+    Tune to the current monitor channel and load the threshold. The rssi
+    code for the threshold depends on the band's calibration offset so it's
+    worked out per channel.
+*/
+/**************************************************************************/
+void SI4313::monitorTune()
+{
+    changeFreqKhz(_monFreq[_monChan]);
+    _monThresh = dbToRssi(_monDB10);
+    writeReg(SI4313_RSSITHRESH, _monThresh);
+    monitorArm();
+}
+
+/**************************************************************************/
+/*!
+    Clear the interrupt status so nIRQ goes high and the next crossing
+    gives a falling edge.
+*/
+/**************************************************************************/
+void SI4313::monitorArm()
+{
+    uint8_t stat[2];
+
+    _monHit = false;
+    burstRead(SI4313_INTPSTAT1, stat, 2);
+    _monArmed = true;
+    _monHop = millis();
+}
+
+/**************************************************************************/
+/*!
+    Radio nIRQ handler. Only timestamps the trigger, the registers are read
+    from monitorPoll() so the SPI bus isn't touched from interrupt context.
+*/
+/**************************************************************************/
+void SI4313::monitorIsr()
+{
+    si4313._monTime = micros();
+    si4313._monHit = true;
+}
+
+/**************************************************************************/
+/*!
+    Put the receiver to sleep for <ms> with the wake up timer running off
+    the 32 kHz RC oscillator. When it expires the radio pulls nIRQ low,
+    which wakes the MCU through external interrupt <irq>, so the radio
+    keeps time for the MCU while both sleep. Call wake() to bring the
+    receiver back.
+
+    The interrupt is on the low level, not the falling edge. In power
+    down the INTn edge detection has no clock and only a level wakes the
+    MCU. nIRQ stays low until the status is read, so the handler turns
+    the interrupt off again.
+
+    The period is 4 * M * 2^R / 32.768 kHz, so M is ms * 8.192 with R
+    raised until M fits 16 bits.
+*/
+/**************************************************************************/
+void SI4313::sleep(uint32_t ms, uint8_t irq)
+{
+    uint32_t m;
+    uint8_t r = 0, stat[2];
+
+    scanStop();
+    monitorStop();
+
+    if (ms > WUT_MAX_MS)
+    {
+        ms = WUT_MAX_MS;
+    }
+    m = (ms << 10) / 125;
+    while (m > 0xFFFF)
+    {
+        m >>= 1;
+        r++;
+    }
+    if (m == 0)
+    {
+        m = 1;
+    }
+
+    writeReg(SI4313_WUTPER1, r);
+    writeReg(SI4313_WUTPER2, m >> 8);
+    writeReg(SI4313_WUTPER3, m);
+
+    // only the wake up timer drives nIRQ
+    writeReg(SI4313_INTPENB1, 0);
+    writeReg(SI4313_INTPENB2, 1<<BIT_ENWUT);
+    burstRead(SI4313_INTPSTAT1, stat, 2);
+
+    _wakeIrq = irq;
+    _wakeHit = false;
+    _asleep = true;
+    attachInterrupt(_wakeIrq, wakeIsr, LOW);
+
+    // xtal and receiver off, wake up timer on
+    writeReg(SI4313_CONTROL1, 1<<BIT_ENWT);
+}
+
+/**************************************************************************/
+/*!
+    True once the wake up timer has fired.
+*/
+/**************************************************************************/
+bool SI4313::wakePending()
+{
+    return _wakeHit;
+}
+
+/**************************************************************************/
+/*!
+    Stop the wake up timer and turn the receiver back on at the frequency
+    it was on before sleep().
+*/
+/**************************************************************************/
+void SI4313::wake()
+{
+    if (!_asleep)
+    {
+        return;
+    }
+
+    detachInterrupt(_wakeIrq);
+    writeReg(SI4313_CONTROL1, 0x05);
+    writeReg(SI4313_INTPENB2, 0);
+    readReg(SI4313_INTPSTAT1);
+    readReg(SI4313_INTPSTAT2);
+    _asleep = false;
+
+    delayMicroseconds(WAKE_XTAL_US);
+    settle(true);
+}
+
+/**************************************************************************/
+/*!
+    Pull the shutdown pin. The radio draws almost nothing but loses its
+    registers, so powerUp() runs the full init again.
+*/
+/**************************************************************************/
+void SI4313::shutdown()
+{
+    scanStop();
+    monitorStop();
+    if (_asleep)
+    {
+        detachInterrupt(_wakeIrq);
+        _asleep = false;
+    }
+    digitalWrite(_sdnPin, HIGH);
+    cacheInvalidate();
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::powerUp()
+{
+    digitalWrite(_sdnPin, LOW);
+    delay(SDN_POR_MS);
+    init();
+}
+
+/**************************************************************************/
+/*!
+    Radio nIRQ handler for the wake up timer. Getting here is what wakes
+    the MCU. The level interrupt would keep firing until wake() reads the
+    status, so it's turned off here.
+*/
+/**************************************************************************/
+void SI4313::wakeIsr()
+{
+    detachInterrupt(si4313._wakeIrq);
+    si4313._wakeHit = true;
+}
+
+/**************************************************************************/
+/*!
+    Read a register. Registers the radio doesn't change on its own are
+    served from the shadow once they've been read or written.
+*/
+/**************************************************************************/
+uint8_t SI4313::readReg(uint8_t addr)
+{
+    uint8_t val, sreg;
+
+    addr &= (SI4313_REGS - 1);
+    if (regCached(addr))
+    {
+        _regsSaved++;
+        return _shadow[addr];
+    }
+
+    sreg = SREG;
+    cli();
+    csLow();
+    SPI.transfer(addr & ~(1<<7)); // send address, bit 7 low for read
+    val = SPI.transfer(0);  // receive data
+    csHigh();
+    SREG = sreg;
+
+    regStore(addr, val);
+    return val;
+}
+
+/**************************************************************************/
+/*!
+    Write a register. The write is skipped if the shadow shows the radio
+    already holds <data>. A software reset clears the shadow since every
+    register goes back to its default.
+*/
+/**************************************************************************/
+void SI4313::writeReg(uint8_t addr, uint8_t data)
+{
+    uint8_t sreg;
+
+    addr &= (SI4313_REGS - 1);
+    if (regCached(addr) && (_shadow[addr] == data))
+    {
+        _regsSaved++;
+        return;
+    }
+
+    sreg = SREG;
+    cli();
+    csLow();
+    SPI.transfer(addr | (1<<7)); // send address, bit 7 high for write
+    SPI.transfer(data);  // send data
+    csHigh();
+    SREG = sreg;
+
+    if ((addr == SI4313_CONTROL1) && (data & (1<<BIT_SWRES)))
+    {
+        cacheInvalidate();
+    }
+    regStore(addr, data);
+}
+
+/**************************************************************************/
+/*!
+    Write <len> consecutive registers starting at <addr> in one chip select
+    assertion. The radio auto-increments the address after each byte.
+    Leading registers the shadow shows are unchanged are trimmed off, and
+    the write is skipped if nothing changed. Retuning inside a band only
+    rewrites the carrier, not the band select. The tail is always written
+    since some registers, like the carrier, latch on their last byte.
+    The burst is cut off at the end of the register map.
+*/
+/**************************************************************************/
+void SI4313::burstWrite(uint8_t addr, const uint8_t *data, uint8_t len)
+{
+    uint8_t sreg;
+
+    addr &= (SI4313_REGS - 1);
+    len = min(len, SI4313_REGS - addr);
+
+    while (len && regCached(addr) && (_shadow[addr] == *data))
+    {
+        addr++;
+        data++;
+        len--;
+        _regsSaved++;
+    }
+    if (!len)
+    {
+        return;
+    }
+
+    sreg = SREG;
+    cli();
+    csLow();
+    SPI.transfer(addr | (1<<7)); // send start address, bit 7 high for write
+    while (len--)
+    {
+        SPI.transfer(*data);
+        regStore(addr++, *data++);
+    }
+    csHigh();
+    SREG = sreg;
+}
+
+/**************************************************************************/
+/*!
+    Read <len> consecutive registers starting at <addr> in one chip select
+    assertion. The radio auto-increments the address after each byte.
+    Served from the shadow if every register in the range is cached. The
+    burst is cut off at the end of the register map.
+*/
+/**************************************************************************/
+void SI4313::burstRead(uint8_t addr, uint8_t *data, uint8_t len)
+{
+    uint8_t sreg, i;
+
+    addr &= (SI4313_REGS - 1);
+    len = min(len, SI4313_REGS - addr);
+
+    for (i=0; (i<len) && regCached(addr + i); i++)
+        ;
+    if (i == len)
+    {
+        memcpy(data, &_shadow[addr], len);
+        _regsSaved += len;
+        return;
+    }
+
+    sreg = SREG;
+    cli();
+    csLow();
+    SPI.transfer(addr & ~(1<<7)); // send start address, bit 7 low for read
+    while (len--)
+    {
+        *data = SPI.transfer(0);
+        regStore(addr++, *data++);
+    }
+    csHigh();
+    SREG = sreg;
+}
+
+/**************************************************************************/
+/*!
+    Number of registers read or written from the shadow instead of the
+    SPI bus. It counts registers, not transactions: a burst counts each
+    register it skips.
+*/
+/**************************************************************************/
+uint32_t SI4313::getRegsSaved()
+{
+    return _regsSaved;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void SI4313::clearRegsSaved()
+{
+    _regsSaved = 0;
+}
+
+/**************************************************************************/
+/*!
+    True if <addr> can be answered from the shadow.
+*/
+/**************************************************************************/
+bool SI4313::regCached(uint8_t addr)
+{
+    addr &= (SI4313_REGS - 1);
+    return (_shadowValid[addr >> 3] & ~pgm_read_byte(&volatileRegs[addr >> 3])) & (1 << (addr & 7));
+}
+
+/**************************************************************************/
+/*!
+    Record the value the radio holds in <addr>. Registers the radio
+    changes on its own are recorded too but regCached never serves them.
+*/
+/**************************************************************************/
+void SI4313::regStore(uint8_t addr, uint8_t data)
+{
+    addr &= (SI4313_REGS - 1);
+    _shadow[addr] = data;
+    _shadowValid[addr >> 3] |= (1 << (addr & 7));
+}
+
+/**************************************************************************/
+/*!
+    Forget the shadow, after a reset or power down.
+*/
+/**************************************************************************/
+void SI4313::cacheInvalidate()
+{
+    memset(_shadowValid, 0, sizeof(_shadowValid));
 }
@@ -2,7 +2,9 @@
 
 #include <stdint.h>
 #include <SPI.h>
+#include <avr/eeprom.h>
 #include "si4313_regs.h"
+#include "sweep.h"
 
 // For handling Arduino 1.0 compatibility and backwards compatibility
 #if ARDUINO >= 100
@@ -13,28 +15,254 @@
 
 #define SCAN_STEP_SIZE 1        // step size in MHz to scan
 
+// pll settle times in microseconds. these are fixed waits, the device
+// status can't tell when the pll has locked: in rx it reads CPS rx with
+// no FREQERR straight after a retune. the datasheet gives 50 us to settle
+// within 10 kHz after a 1 MHz step, so a step inside the same band gets
+// twice that. a band switch also recalibrates the vco, which takes about
+// the 200 us of the tune to rx transition, so it gets 300. 1 ms is over
+// three times the slowest datasheet figure, a longer wait only slows the
+// scan down, so setSettle() stops there.
+#define SETTLE_STEP_US  100
+#define SETTLE_BAND_US  300
+#define SETTLE_MAX_US   1000
+
+// rx data rate the clock recovery is configured for, same as the
+// spreadsheet settings in begin()
+#define RX_DATA_RATE    9600
+
+// per bin detector modes
+enum
+{
+    DET_SAMPLE = 0,     // single rssi read
+    DET_AVG,            // average of the rssi readings (log domain)
+    DET_PEAK,           // peak hold
+    DET_MIN,            // min hold
+    DET_RMS             // average in the power domain
+};
+
+#define DET_MAX_SAMPLES 255
+
+// number of band select values with a calibration offset. 24 low band
+// (10 MHz each) and 24 high band (20 MHz each).
+#define CAL_BANDS       48
+
+// max coarse bins for an adaptive scan
+#define ADAPT_MAX_COARSE 256
+
+// crystal start up when coming out of sleep, and power on reset time
+// after releasing the shutdown pin
+#define WAKE_XTAL_US    600
+#define SDN_POR_MS      16
+
+// longest wake up timer period. the period in ms is scaled by 8.192 to
+// get timer ticks, this keeps that inside 32 bits
+#define WUT_MAX_MS      4000000UL
+
+// size of the register map kept in the shadow cache
+#define SI4313_REGS     0x80
+
+// max channels the wake on signal monitor cycles through
+#define MON_MAX_CHANNELS 8
+
 typedef struct
 {
     uint16_t freq;
     int16_t db;
 } scan_t;
 
+// tuning state for a sweep. the carrier is carried as a quotient and a
+// remainder in fifths of an lsb so stepping needs no division.
+typedef struct
+{
+    uint32_t khz;       // current frequency in kHz
+    uint16_t step;      // step size in kHz
+    uint16_t fc;        // nominal carrier
+    uint8_t fb;         // band select register value
+    uint8_t rem;        // carrier remainder, in fifths of an lsb
+    uint32_t dq;        // carrier increment per step
+    uint8_t dr;         // carrier remainder increment per step
+} tune_t;
+
+// detector accumulator for one bin
+typedef struct
+{
+    uint32_t sum;
+    unsigned long start;
+    uint8_t hi;
+    uint8_t lo;
+    uint8_t n;
+} det_t;
+
+// non-blocking scan engine states
+enum
+{
+    SCAN_IDLE = 0,
+    SCAN_TUNE,
+    SCAN_SETTLE,
+    SCAN_MEASURE,
+    SCAN_WAIT           // buffer full, waiting for scanResume
+};
+
+// called when a non-blocking scan completes with the number of points
+typedef void (*scan_cb_t)(uint32_t count);
+
+// called when a non-blocking scan fills its buffer. returns the next buffer
+// to fill, or NULL to pause the scan until scanResume.
+typedef int16_t *(*scan_chunk_cb_t)(int16_t *db, uint32_t count);
+
+// called once per pll settle wait during a blocking scan, to get other
+// work done meanwhile, such as draining the gps
+typedef void (*scan_idle_cb_t)();
+
+// rssi threshold trigger caught by the monitor
+typedef struct
+{
+    unsigned long time;     // micros() when the radio interrupt fired
+    uint32_t freq;          // kHz
+    int16_t db10;           // level read back after the trigger
+} mon_evt_t;
+
 class SI4313
 {
     uint8_t _csPin;
     uint8_t _sdnPin;
+    volatile uint8_t *_csPort;  // chip select port register, for direct port access
+    uint8_t _csMask;
+    uint8_t _freqSel;           // last band select written, to classify steps
+    uint16_t _settleStepUs;
+    uint16_t _settleBandUs;
+    uint16_t _rbw;              // current if filter bandwidth in 100 Hz units, 0 if spreadsheet default
+    bool _autoRbw;              // pick the rbw from the step size at the start of each scan
+    uint8_t _detMode;
+    uint8_t _detSamples;        // samples per bin when dwell is 0
+    uint16_t _detDwellUs;       // dwell per bin, overrides the sample count
+    int8_t _cal[CAL_BANDS];     // per band level offsets in 0.5 dB units
+    unsigned long _settleStart;
+    uint16_t _settleMinUs;
+    scan_idle_cb_t _idle;
+
+    // non-blocking scan state
+    uint8_t _asState;
+    tune_t _asTune;
+    det_t _asDet;
+    int16_t *_asBuf;
+    uint32_t _asBufLen;
+    uint32_t _asBufIdx;
+    uint32_t _asIdx;
+    uint32_t _asCount;
+    scan_cb_t _asDone;
+    scan_chunk_cb_t _asChunk;
+
+    // wake on signal monitor state
+    uint32_t _monFreq[MON_MAX_CHANNELS];
+    uint8_t _monCount;
+    uint8_t _monChan;
+    uint8_t _monIrq;
+    uint8_t _monThresh;         // rssi threshold for the current channel
+    int16_t _monDB10;           // threshold level before calibration
+    uint16_t _monDwellMs;
+    unsigned long _monHop;
+    bool _monActive;
+    bool _monArmed;             // interrupt status cleared and waiting for a trigger
+    volatile bool _monHit;
+    volatile unsigned long _monTime;
+
+    // wake up timer
+    uint8_t _wakeIrq;
+    bool _asleep;
+    volatile bool _wakeHit;
+
+    // write through shadow of the register map. status and measurement
+    // registers are never cached.
+    uint8_t _shadow[SI4313_REGS];
+    uint8_t _shadowValid[SI4313_REGS / 8];
+    uint32_t _regsSaved;        // registers read or written from the shadow, not spi transactions
 
 public:
     void begin(uint8_t csPin, uint8_t sdnPin);
     void writeReg(uint8_t addr, uint8_t data);
     uint8_t readReg(uint8_t addr);
+    void burstWrite(uint8_t addr, const uint8_t *data, uint8_t len);
+    void burstRead(uint8_t addr, uint8_t *data, uint8_t len);
     void changeFreq(uint16_t freq);
+    void changeFreqKhz(uint32_t khz);
+    void setSettle(uint16_t stepUs, uint16_t bandUs);
+    void setScanIdle(scan_idle_cb_t idle);
+    uint16_t setRbw(uint16_t rbw);
+    uint16_t setRbwForStep(uint32_t stepKhz);
+    uint16_t getRbw();
+    void setAutoRbw(bool enable);
     uint8_t getRssi();
     int16_t getDB();
+    int16_t getDB10();
+    void setDetector(uint8_t mode, uint8_t samples, uint16_t dwellUs);
+    int16_t measure();
+    int16_t calibrate(uint16_t freq, int16_t refDB);
+    int8_t getCalOffset(uint8_t band);
+    void setCalOffset(uint8_t band, int8_t offset);
+    void calLoad();
+    void calSave();
+    void calClear();
     uint32_t scan(uint16_t start, uint16_t stop, scan_t *data);
+    uint32_t scanHop(uint16_t start, uint16_t stop, scan_t *data);
+    uint32_t scanKhz(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t maxPoints);
+    uint16_t scan(uint32_t start, uint32_t stop, uint16_t step, sweep_t *sw);
+    uint16_t scanAdaptive(uint32_t start, uint32_t stop, uint16_t fineStep, uint16_t coarseStep, uint8_t thresh, sweep_t *sw);
+    uint32_t scanStart(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, scan_cb_t done);
+    uint32_t scanStartChunked(uint32_t start, uint32_t stop, uint16_t step, int16_t *db, uint32_t len, scan_chunk_cb_t chunk, scan_cb_t done);
+    void scanResume(int16_t *db);
+    bool scanPoll();
+    void scanStop();
+    bool scanBusy();
+    uint32_t scanProgress();
+    bool monitorStart(uint8_t irq, const uint32_t *freq, uint8_t count, int16_t db10, uint16_t dwellMs);
+    bool monitorPoll(mon_evt_t *evt);
+    void monitorStop();
+    bool monitorBusy();
+    void sleep(uint32_t ms, uint8_t irq);
+    bool wakePending();
+    void wake();
+    void shutdown();
+    void powerUp();
+    uint32_t getRegsSaved();
+    void clearRegsSaved();
 
 private:
+    void init();
+    void settle(bool bandSwitch);
+    void settleStart(bool bandSwitch);
+    bool settleDone();
+    void settleWait();
+    bool tuneCalc(uint32_t khz, tune_t *t);
+    void tuneNext(tune_t *t);
+    void tuneLoad(tune_t *t);
+    void tuneWrite(tune_t *t);
+    uint16_t scanLevels(uint32_t start, uint16_t step, uint8_t *level, uint16_t count, uint16_t *binUs);
+    void rbwWrite(uint8_t idx);
+    void rbwDefault();
+    void rbwRestore(uint16_t rbw);
+    uint8_t detect();
+    void detReset(det_t *d);
+    bool detAdd(det_t *d, uint8_t rssi);
+    uint8_t detResult(det_t *d);
+    int16_t rssiToDB10(uint8_t rssi);
+    int16_t rssiToDB(uint8_t rssi);
+    uint8_t rssiToLevel(uint8_t rssi);
+    uint8_t calBand();
+    uint8_t dbToRssi(int16_t db10);
+    void monitorTune();
+    void monitorArm();
+    static void monitorIsr();
+    static void wakeIsr();
+    bool regCached(uint8_t addr);
+    void regStore(uint8_t addr, uint8_t data);
+    void cacheInvalidate();
 
+    // chip select is toggled directly on the port. digitalWrite is too slow
+    // to use inside the frequency sweep loop.
+    inline void csLow()  { *_csPort &= ~_csMask; }
+    inline void csHigh() { *_csPort |= _csMask; }
 };
 
 extern SI4313 si4313;
@@ -71,3 +71,8 @@
 #define BIT_SWRES 7
 #define BIT_IPOR 0
 #define BIT_ICHIPRDY 1
+#define BIT_IRSSI 4
+#define BIT_ENRSSI 4
+#define BIT_IWUT 3
+#define BIT_ENWUT 3
+#define BIT_ENWT 5
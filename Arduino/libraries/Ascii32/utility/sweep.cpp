@@ -0,0 +1,119 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "sweep.h"
+
+/**************************************************************************/
+/*!
+    Set up an empty sweep using <level> as storage for <size> points.
+*/
+/**************************************************************************/
+void sweep_init(sweep_t *sw, uint8_t *level, uint16_t size)
+{
+    sw->start = 0;
+    sw->step = 0;
+    sw->count = 0;
+    sw->size = size;
+    sw->level = level;
+    sw->t0 = 0;
+    sw->t1 = 0;
+    sw->binUs = NULL;
+}
+
+/**************************************************************************/
+/*!
+    Frequency of point <idx> in kHz.
+*/
+/**************************************************************************/
+uint32_t sweep_freq(const sweep_t *sw, uint16_t idx)
+{
+    return sw->start + ((uint32_t)idx * sw->step);
+}
+
+/**************************************************************************/
+/*!
+    Level of point <idx> in tenths of dB.
+*/
+/**************************************************************************/
+int16_t sweep_db10(const sweep_t *sw, uint16_t idx)
+{
+    return LEVEL_TO_DB10(sw->level[idx]);
+}
+
+/**************************************************************************/
+/*!
+    Level byte for <db> in whole dB, clamped to the range a byte covers.
+*/
+/**************************************************************************/
+uint8_t sweep_level(int16_t db)
+{
+    int16_t lvl = (db - LEVEL_FLOOR_DB) * 2;
+
+    return (lvl < 0) ? 0 : ((lvl > 255) ? 255 : lvl);
+}
+
+/**************************************************************************/
+/*!
+    Print the sweep as text: a "sweep, <start>, <step>, <count>" line
+    followed by the levels as two hex digits per point, 32 points per line.
+*/
+/**************************************************************************/
+void sweep_print(Print *out, const sweep_t *sw)
+{
+    static const char hex[] PROGMEM = "0123456789ABCDEF";
+    uint16_t i;
+
+    out->print(F("sweep, "));
+    out->print(sw->start);
+    out->print(F(", "));
+    out->print(sw->step);
+    out->print(F(", "));
+    out->println(sw->count);
+
+    for (i=0; i<sw->count; i++)
+    {
+        out->write(pgm_read_byte(&hex[sw->level[i] >> 4]));
+        out->write(pgm_read_byte(&hex[sw->level[i] & 0x0F]));
+        if (((i & 31) == 31) || (i == sw->count - 1))
+        {
+            out->println();
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// For handling Arduino 1.0 compatibility and backwards compatibility
+#if ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+// levels are stored in 0.5 dB steps above LEVEL_FLOOR_DB, so a byte covers
+// -128 dB to -0.5 dB
+#define LEVEL_FLOOR_DB  -128
+#define LEVEL_TO_DB10(l) (((int16_t)(l) * 5) + (LEVEL_FLOOR_DB * 10))
+
+// compact sweep. one byte per point, the frequency of point i is
+// start + i*step. the level storage is provided by the caller, and so
+// is binUs if the time spent on each point is wanted.
+typedef struct
+{
+    uint32_t start;     // kHz
+    uint16_t step;      // kHz
+    uint16_t count;     // points in the sweep
+    uint16_t size;      // capacity of level
+    uint8_t *level;
+    unsigned long t0;   // micros() when the sweep started
+    unsigned long t1;   // micros() when it finished
+    uint16_t *binUs;    // optional, us from the start of each point to the next, tuning included
+} sweep_t;
+
+void sweep_init(sweep_t *sw, uint8_t *level, uint16_t size);
+uint32_t sweep_freq(const sweep_t *sw, uint16_t idx);
+int16_t sweep_db10(const sweep_t *sw, uint16_t idx);
+uint8_t sweep_level(int16_t db);
+void sweep_print(Print *out, const sweep_t *sw);
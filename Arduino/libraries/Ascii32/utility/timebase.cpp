@@ -0,0 +1,297 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "timebase.h"
+
+#define TIMEBASE_Q 32       // fraction bits of the rate correction factor
+
+static uint8_t _ppsIrq = TIMEBASE_NO_PPS;
+static volatile unsigned long _ppsTime;
+static volatile uint8_t _ppsSeq;
+static uint8_t _ppsUsed;
+
+static bool _synced;
+static uint8_t _source;
+static unsigned long _edge;     // micros() at the last edge
+static utc_t _utc;              // UTC at the last edge
+static unsigned long _refEdge;  // start of the current rate measurement
+static utc_t _refUtc;
+static bool _rateValid;
+static int32_t _ppm16;
+static int32_t _k;              // _ppm16 as a Q32 factor
+static int32_t _residual;
+static uint32_t _edges;
+static uint32_t _lastTime;
+static uint16_t _lastMs;
+
+/**************************************************************************/
+/*!
+    PPS rising edge. Only the time is taken here.
+*/
+/**************************************************************************/
+static void ppsIsr()
+{
+    _ppsTime = micros();
+    _ppsSeq++;
+}
+
+/**************************************************************************/
+/*!
+    Add <us> microseconds to <t>, which can be negative.
+*/
+/**************************************************************************/
+static void utcAdd(utc_t *t, int32_t us)
+{
+    int32_t sec = us / 1000000L;
+    int32_t frac = (int32_t)t->us + (us - (sec * 1000000L));
+
+    if (frac < 0)
+    {
+        frac += 1000000L;
+        sec--;
+    }
+    else if (frac >= 1000000L)
+    {
+        frac -= 1000000L;
+        sec++;
+    }
+    t->sec += sec;
+    t->us = frac;
+}
+
+/**************************************************************************/
+/*!
+    <a> - <b> in microseconds, clipped to about +-2000 s.
+*/
+/**************************************************************************/
+static int32_t utcDiff(const utc_t *a, const utc_t *b)
+{
+    int32_t sec = (int32_t)(a->sec - b->sec);
+
+    if (sec > 2000)
+    {
+        sec = 2000;
+    }
+    else if (sec < -2000)
+    {
+        sec = -2000;
+    }
+    return (sec * 1000000L) + ((int32_t)a->us - (int32_t)b->us);
+}
+
+/**************************************************************************/
+/*!
+    Correct a span of micros() for the measured clock error.
+*/
+/**************************************************************************/
+static int32_t localToUtc(int32_t dt)
+{
+    return dt + (int32_t)(((int64_t)dt * _k) >> TIMEBASE_Q);
+}
+
+/**************************************************************************/
+/*!
+    Take an edge at micros() <edge> that is known to be at UTC <obs>. The
+    first one sets the timebase. After that the phase is pulled toward
+    each edge, all the way for PPS or 1/TIMEBASE_NMEA_GAIN of the way for
+    the noisier sentence arrival, and the clock rate is measured over
+    spans of at least TIMEBASE_RATE_SPAN_S. An edge a second or more away
+    from where it was expected starts over.
+*/
+/**************************************************************************/
+static void timebaseEdge(unsigned long edge, const utc_t *obs, uint8_t source)
+{
+    utc_t pred;
+    int32_t r, local, span, meas;
+
+    if (_synced && (source == _source))
+    {
+        pred = _utc;
+        utcAdd(&pred, localToUtc((int32_t)(edge - _edge)));
+        r = utcDiff(obs, &pred);
+        if ((r > -1000000L) && (r < 1000000L))
+        {
+            _residual = r;
+            utcAdd(&pred, (source == TIMEBASE_PPS) ? r : r / TIMEBASE_NMEA_GAIN);
+            _edge = edge;
+            _utc = pred;
+            _edges++;
+
+            // rate from the raw edges, so the phase filter doesn't bias it
+            local = (int32_t)(edge - _refEdge);
+            span = utcDiff(obs, &_refUtc);
+            if ((span >= TIMEBASE_RATE_SPAN_S * 1000000L) && (local > 0))
+            {
+                meas = ((int64_t)(span - local) * 16000000L) / local;
+                if ((meas > -TIMEBASE_MAX_PPM * 16L) && (meas < TIMEBASE_MAX_PPM * 16L))
+                {
+                    _ppm16 = _rateValid ? _ppm16 + ((meas - _ppm16) / 4) : meas;
+                    _k = ((int64_t)_ppm16 << TIMEBASE_Q) / 16000000L;
+                    _rateValid = true;
+                }
+                _refEdge = edge;
+                _refUtc = *obs;
+            }
+            return;
+        }
+    }
+
+    // first edge, or lost track. the rate is kept, it won't have moved much.
+    _synced = true;
+    _source = source;
+    _edge = edge;
+    _utc = *obs;
+    _refEdge = edge;
+    _refUtc = *obs;
+    _residual = 0;
+    _edges = 1;
+}
+
+/**************************************************************************/
+/*!
+    Use the gps PPS output on external interrupt <ppsIrq>, or
+    TIMEBASE_NO_PPS to go by the arrival of the RMC sentences instead.
+    Starts the timebase over.
+*/
+/**************************************************************************/
+void timebase_init(uint8_t ppsIrq)
+{
+    if (_ppsIrq != TIMEBASE_NO_PPS)
+    {
+        detachInterrupt(_ppsIrq);
+    }
+
+    _ppsIrq = ppsIrq;
+    _synced = false;
+    _source = TIMEBASE_NONE;
+    _edges = 0;
+    _residual = 0;
+    _lastTime = 0;
+    _lastMs = 0;
+
+    if (ppsIrq != TIMEBASE_NO_PPS)
+    {
+        _ppsUsed = _ppsSeq;
+        attachInterrupt(ppsIrq, ppsIsr, RISING);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Feed the timebase after each gps update. <rmcEdge> is micros() when
+    the RMC that set <fix> arrived. Nothing is done until the fix moves to
+    a new epoch, and only valid fixes are used since the gps time before
+    a fix can be off.
+
+    With PPS, only the whole second RMC is used and the edge is the pulse
+    before it, which marks the start of that second. Otherwise the edge
+    is the RMC arrival less TIMEBASE_NMEA_LAG_US.
+*/
+/**************************************************************************/
+void timebase_update(const gps_fix_t *fix, unsigned long rmcEdge)
+{
+    unsigned long edge;
+    uint8_t seq, sreg;
+    utc_t obs;
+
+    if (!fix->valid || ((fix->time == _lastTime) && (fix->ms == _lastMs)))
+    {
+        return;
+    }
+    _lastTime = fix->time;
+    _lastMs = fix->ms;
+
+    obs.sec = fix->time;
+    obs.us = (uint32_t)fix->ms * 1000;
+
+    if (_ppsIrq != TIMEBASE_NO_PPS)
+    {
+        sreg = SREG;
+        cli();
+        seq = _ppsSeq;
+        edge = _ppsTime;
+        SREG = sreg;
+
+        if ((fix->ms != 0) || (seq == _ppsUsed) || ((rmcEdge - edge) > 1000000UL))
+        {
+            return;
+        }
+        _ppsUsed = seq;
+        timebaseEdge(edge, &obs, TIMEBASE_PPS);
+    }
+    else
+    {
+        timebaseEdge(rmcEdge - TIMEBASE_NMEA_LAG_US, &obs, TIMEBASE_NMEA);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Convert the micros() time <us> to UTC in <utc>. Works for times before
+    or after the last edge, up to about half an hour away. Returns false,
+    with <utc> zeroed, until the timebase has had its first edge.
+*/
+/**************************************************************************/
+bool timebase_utc(unsigned long us, utc_t *utc)
+{
+    if (!_synced)
+    {
+        utc->sec = 0;
+        utc->us = 0;
+        return false;
+    }
+
+    *utc = _utc;
+    utcAdd(utc, localToUtc((int32_t)(us - _edge)));
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Timebase state for diagnostics.
+*/
+/**************************************************************************/
+void timebase_stats(timebase_stats_t *st)
+{
+    st->source = _synced ? _source : TIMEBASE_NONE;
+    st->ppm16 = _ppm16;
+    st->residual = _residual;
+    st->edges = _edges;
+}
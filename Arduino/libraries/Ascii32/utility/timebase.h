@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include "gps.h"
+
+// gps disciplined timebase. micros() times are converted to UTC using
+// edges at known gps times, either the PPS pulse or the arrival of the
+// RMC sentence, with the MCU clock error measured between them. the
+// resolution is that of micros(), 4 us at 16 MHz or 8 us at 8 MHz.
+#define TIMEBASE_NO_PPS         0xFF
+#define TIMEBASE_RATE_SPAN_S    10      // shortest span the clock rate is measured over
+#define TIMEBASE_NMEA_GAIN      4       // sentence arrival jitters, so only pull part way
+#define TIMEBASE_MAX_PPM        20000L  // larger rate errors are taken as a missed edge
+#define TIMEBASE_NMEA_LAG_US    0       // fixed delay from the epoch to the RMC '$', module dependent
+
+// edge the timebase follows
+enum
+{
+    TIMEBASE_NONE = 0,      // not synced yet
+    TIMEBASE_NMEA,          // RMC arrival
+    TIMEBASE_PPS            // PPS pulse
+};
+
+// UTC with microseconds
+typedef struct
+{
+    uint32_t sec;           // seconds since 1970-01-01
+    uint32_t us;            // microseconds into the second
+} utc_t;
+
+typedef struct
+{
+    uint8_t source;         // TIMEBASE_*
+    int32_t ppm16;          // MCU clock error in 1/16 ppm, positive if micros() runs slow
+    int32_t residual;       // us from the last edge to where it was expected
+    uint32_t edges;         // edges since the timebase last started over
+} timebase_stats_t;
+
+void timebase_init(uint8_t ppsIrq);
+void timebase_update(const gps_fix_t *fix, unsigned long rmcEdge);
+bool timebase_utc(unsigned long us, utc_t *utc);
+void timebase_stats(timebase_stats_t *st);
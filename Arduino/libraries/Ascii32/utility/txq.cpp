@@ -0,0 +1,251 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "txq.h"
+
+TxQueue txq;
+
+/**************************************************************************/
+/*!
+    Queue output for <port>, which has to be Serial on USART0.
+*/
+/**************************************************************************/
+void TxQueue::begin(HardwareSerial *port)
+{
+    byte sreg = SREG;
+
+    cli();
+    UCSR0B &= ~_BV(TXCIE0);
+    _port = port;
+    _head = 0;
+    _tail = 0;
+    _held = false;
+    SREG = sreg;
+    clearStats();
+}
+
+/**************************************************************************/
+/*!
+    Zero the counters. The peak starts again from what's queued now.
+*/
+/**************************************************************************/
+void TxQueue::clearStats()
+{
+    drops = 0;
+    waits = 0;
+    peak = used();
+}
+
+/**************************************************************************/
+/*!
+    Bytes waiting to go out. The indexes are two bytes, so they're read
+    with interrupts off.
+*/
+/**************************************************************************/
+uint16_t TxQueue::used()
+{
+    uint16_t n;
+    byte sreg = SREG;
+
+    cli();
+    n = (_head - _tail) & (TXQ_SZ - 1);
+    SREG = sreg;
+    return n;
+}
+
+/**************************************************************************/
+/*!
+    Hand the core the next TXQ_REFILL bytes, if its buffer is empty. The core turns
+    its interrupt off once the buffer has gone, so Serial.write can't
+    wait here. Keeps the transmit complete interrupt on while there's
+    more to come. Runs with interrupts off.
+*/
+/**************************************************************************/
+void TxQueue::refill()
+{
+    uint16_t n, run;
+
+    if (!(UCSR0B & _BV(UDRIE0)))
+    {
+        n = min((_head - _tail) & (TXQ_SZ - 1), TXQ_REFILL);
+        while (n)
+        {
+            run = min(n, TXQ_SZ - _tail);
+            _port->write(&_buf[_tail], run);
+            _tail = (_tail + run) & (TXQ_SZ - 1);
+            n -= run;
+        }
+    }
+
+    if (_head != _tail)
+    {
+        UCSR0B |= _BV(TXCIE0);
+    }
+    else
+    {
+        UCSR0B &= ~_BV(TXCIE0);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Transmit complete. The core's buffer and the shift register are empty.
+*/
+/**************************************************************************/
+void TxQueue::isr()
+{
+    refill();
+}
+
+ISR(USART0_TX_vect)
+{
+    txq.isr();
+}
+
+/**************************************************************************/
+/*!
+    Wait for everything queued to reach the port.
+*/
+/**************************************************************************/
+void TxQueue::flush()
+{
+    while (used())
+        ;
+}
+
+/**************************************************************************/
+/*!
+    Drain the ring and stop the interrupt so the caller can write to the
+    port itself. Writes in the meantime go straight to the port.
+*/
+/**************************************************************************/
+void TxQueue::hold()
+{
+    byte sreg;
+
+    flush();
+    sreg = SREG;
+    cli();
+    UCSR0B &= ~_BV(TXCIE0);
+    _held = true;
+    SREG = sreg;
+}
+
+/**************************************************************************/
+/*!
+    Go back to queueing. The ring is empty, the next write starts it.
+*/
+/**************************************************************************/
+void TxQueue::release()
+{
+    _held = false;
+}
+
+/**************************************************************************/
+/*!
+    True if <len> more bytes fit. If not, the caller drops its packet and
+    it's counted.
+*/
+/**************************************************************************/
+bool TxQueue::reserve(uint16_t len)
+{
+    if (_held || (used() + len < TXQ_SZ))
+    {
+        return true;
+    }
+    drops++;
+    return false;
+}
+
+/**************************************************************************/
+/*!
+    Queue one byte, waiting for room if the ring is full.
+*/
+/**************************************************************************/
+size_t TxQueue::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+/**************************************************************************/
+/*!
+    Queue <size> bytes, waiting for room if the ring is full, and start
+    the port if it's idle. While held they go straight to the port.
+*/
+/**************************************************************************/
+size_t TxQueue::write(const uint8_t *buf, size_t size)
+{
+    uint16_t n = size, run, room, head = _head;
+    bool waited = false;
+    byte sreg;
+
+    if (_held)
+    {
+        return _port->write(buf, size);
+    }
+
+    while (n)
+    {
+        room = TXQ_SZ - 1 - used();
+        if (room == 0)
+        {
+            waited = true;
+            continue;
+        }
+        run = min(min(n, room), TXQ_SZ - head);
+        memcpy(&_buf[head], buf, run);
+        head = (head + run) & (TXQ_SZ - 1);
+        buf += run;
+        n -= run;
+
+        sreg = SREG;
+        cli();
+        _head = head;
+        if (!(UCSR0B & _BV(TXCIE0)))
+        {
+            refill();
+        }
+        SREG = sreg;
+    }
+
+    waits += waited;
+    peak = max(peak, used());
+    return size;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// For handling Arduino 1.0 compatibility and backwards compatibility
+#if ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+// transmit queue in front of the host serial port, USART0. the core
+// owns the data register empty interrupt and its 64 byte buffer, and
+// Serial.write spins once that fills. output goes into this ring
+// instead, and the transmit complete interrupt, which the core leaves
+// alone, hands the core the next TXQ_REFILL bytes each time its buffer
+// has gone out. nothing waits on the port.
+//
+// write() waits for room in the ring and counts it as backpressure, for
+// text that mustn't be lost. a sender that mustn't stall asks reserve()
+// first and drops its whole packet if the room isn't there.
+//
+// the interrupt calls into Serial.write, which isn't reentrant, so
+// nothing else may write to Serial while the queue is draining. the
+// shell writes its echo and prompt to Serial itself, so the sketch holds
+// the queue around polling it: hold() drains the ring and turns the
+// interrupt off, and until release() writes go straight to the port in
+// order with the shell's own output, waiting for it like Serial does.
+#define TXQ_SZ          1024        // power of 2
+// bytes per refill. each is a Serial.write with interrupts off, about 5
+// us, so a refill stays well under a character at 115200 on the gps
+// uart. the line idles for the interrupt latency once per refill.
+#define TXQ_REFILL      8
+
+class TxQueue : public Print
+{
+public:
+    void begin(HardwareSerial *port);
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t *buf, size_t size);
+    using Print::write;
+    bool reserve(uint16_t len);
+    uint16_t used();
+    void flush();
+    void hold();
+    void release();
+    void clearStats();
+    void isr();
+
+    uint32_t drops;         // packets refused by reserve()
+    uint32_t waits;         // writes that had to wait for room
+    uint16_t peak;          // most bytes queued
+
+private:
+    void refill();
+
+    HardwareSerial *_port;
+    uint8_t _buf[TXQ_SZ];
+    volatile uint16_t _head;    // next byte in, only moved by write()
+    volatile uint16_t _tail;    // next byte out, only moved by refill()
+    bool _held;                 // writes bypass the ring
+};
+
+extern TxQueue txq;
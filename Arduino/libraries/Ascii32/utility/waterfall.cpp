@@ -0,0 +1,204 @@
+/*******************************************************************
+    Copyright (C) 2013 FreakLabs
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+
+    1. Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+    3. Neither the name of the the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software
+       without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+    FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+    DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+    OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+    HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+    LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+    OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+    SUCH DAMAGE.
+
+    Originally written by Christopher Wang aka Akiba.
+    Please post support questions to the FreakLabs forum.
+
+*******************************************************************/
+/*!
+    \file 
+    \ingroup
+
+
+*/
+/**************************************************************************/
+#include "waterfall.h"
+
+/**************************************************************************/
+/*!
+    Set up an empty waterfall using <level> as row storage for <size>
+    bytes and <time> as timestamps for up to <maxRows> rows.
+*/
+/**************************************************************************/
+void waterfall_init(waterfall_t *wf, uint8_t *level, uint16_t size, uint32_t *time, uint8_t maxRows)
+{
+    wf->start = 0;
+    wf->step = 0;
+    wf->points = 0;
+    wf->size = size;
+    wf->maxRows = maxRows;
+    wf->depth = 0;
+    wf->level = level;
+    wf->time = time;
+    waterfall_clear(wf);
+}
+
+/**************************************************************************/
+/*!
+    Set the sweep every row holds and empty the history. The depth is as
+    many rows of <points> as fit in the storage. Returns false if not even
+    one row fits.
+*/
+/**************************************************************************/
+bool waterfall_config(waterfall_t *wf, uint32_t start, uint16_t step, uint16_t points)
+{
+    uint16_t depth;
+
+    if ((points == 0) || (points > wf->size))
+    {
+        wf->depth = 0;
+        return false;
+    }
+
+    depth = wf->size / points;
+    wf->start = start;
+    wf->step = step;
+    wf->points = points;
+    wf->depth = (depth < wf->maxRows) ? depth : wf->maxRows;
+    waterfall_clear(wf);
+    return true;
+}
+
+/**************************************************************************/
+/*!
+
+*/
+/**************************************************************************/
+void waterfall_clear(waterfall_t *wf)
+{
+    wf->head = 0;
+    wf->count = 0;
+    wf->total = 0;
+}
+
+/**************************************************************************/
+/*!
+    Storage for the next row. Fill in <points> levels, then add the row
+    with waterfall_commit(). Nothing is copied, the sweep is measured
+    straight into the ring.
+*/
+/**************************************************************************/
+uint8_t *waterfall_row(waterfall_t *wf)
+{
+    return &wf->level[(uint16_t)wf->head * wf->points];
+}
+
+/**************************************************************************/
+/*!
+    Add the row filled in through waterfall_row(), stamped with <time>.
+    Overwrites the oldest row when the history is full.
+*/
+/**************************************************************************/
+void waterfall_commit(waterfall_t *wf, uint32_t time)
+{
+    if (wf->depth == 0)
+    {
+        return;
+    }
+
+    wf->time[wf->head] = time;
+    if (++wf->head >= wf->depth)
+    {
+        wf->head = 0;
+    }
+    if (wf->count < wf->depth)
+    {
+        wf->count++;
+    }
+    wf->total++;
+}
+
+/**************************************************************************/
+/*!
+    Point <sw> at row <idx>, where 0 is the oldest row held. The sweep
+    refers to the ring storage, so it's only valid until the row gets
+    overwritten. Returns false if there's no such row.
+*/
+/**************************************************************************/
+bool waterfall_get(const waterfall_t *wf, uint8_t idx, sweep_t *sw, uint32_t *time)
+{
+    uint16_t row;
+
+    if (idx >= wf->count)
+    {
+        return false;
+    }
+
+    // the oldest row is at head once the ring has wrapped
+    row = (uint16_t)wf->head + wf->depth - wf->count + idx;
+    if (row >= wf->depth)
+    {
+        row -= wf->depth;
+    }
+
+    sw->start = wf->start;
+    sw->step = wf->step;
+    sw->count = wf->points;
+    sw->size = wf->points;
+    sw->level = &wf->level[row * wf->points];
+    if (time)
+    {
+        *time = wf->time[row];
+    }
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Index of the oldest row stamped at or after <time>, or the row count if
+    there is none. Rows are added in time order so this is a binary search.
+    Times are compared by difference so it still works when the clock
+    wraps.
+*/
+/**************************************************************************/
+uint8_t waterfall_find(const waterfall_t *wf, uint32_t time)
+{
+    uint8_t lo = 0, hi = wf->count, mid;
+    uint16_t row;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) >> 1;
+        row = (uint16_t)wf->head + wf->depth - wf->count + mid;
+        if (row >= wf->depth)
+        {
+            row -= wf->depth;
+        }
+
+        if ((int32_t)(wf->time[row] - time) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include "sweep.h"
+
+// waterfall history. a ring of compact sweep rows that all share the same
+// start, step and point count, so only the levels and a timestamp are kept
+// per row. storage is provided by the caller and the number of rows is
+// however many fit, so memory use is fixed. when full, adding a row
+// overwrites the oldest one.
+typedef struct
+{
+    uint32_t start;     // kHz
+    uint16_t step;      // kHz
+    uint16_t points;    // points per row
+    uint16_t size;      // capacity of level in bytes
+    uint8_t maxRows;    // capacity of time
+    uint8_t depth;      // rows that fit for the current points
+    uint8_t head;       // next row to be written
+    uint8_t count;      // rows held
+    uint32_t total;     // rows added since the last config, including overwritten ones
+    uint8_t *level;
+    uint32_t *time;
+} waterfall_t;
+
+void waterfall_init(waterfall_t *wf, uint8_t *level, uint16_t size, uint32_t *time, uint8_t maxRows);
+bool waterfall_config(waterfall_t *wf, uint32_t start, uint16_t step, uint16_t points);
+void waterfall_clear(waterfall_t *wf);
+uint8_t *waterfall_row(waterfall_t *wf);
+void waterfall_commit(waterfall_t *wf, uint32_t time);
+bool waterfall_get(const waterfall_t *wf, uint8_t idx, sweep_t *sw, uint32_t *time);
+uint8_t waterfall_find(const waterfall_t *wf, uint32_t time);
@@ -1,4 +1,5 @@
 #include <avr/wdt.h>
+#include <avr/sleep.h>
 #include <chibi.h>
 #include <SPI.h>
 #include <SdFat.h>
@@ -6,7 +7,80 @@
 
 #define DATECODE "2013-05-07"
 
-static char line[100];
+#define BENCH_CHUNK 64
+#define SCAN_CHUNK 64
+#define BG_SCAN_SZ 256
+#define SWEEP_SZ 720
+#define WF_SZ 2048         // two rows of SWEEP_SZ, more of narrower ones
+#define WF_ROWS 64
+#define WF_UTC_MS 1800000UL   // oldest row "wf dump bin" gives a UTC, the timebase's reach
+// widest row that can be sent or logged. a row has to fit in a packet
+// in the transmit queue, and in sweep to be read back from the log.
+#define WF_SEND_SZ min(SWEEP_SZ, TXQ_SZ - FRAME_SWEEP_SIZE(0))
+#define LOG_MB 16         // default log file size
+#define KEY_EVERY 16      // sweeps between codec keyframes
+#define HOST_BAUD 57600
+#define BAUD_CONFIRM_MS 2000  // for the host to answer at a new baud rate
+
+// survey mode. the shell stays up for SURVEY_LISTEN_MS after each sweep
+// before the MCU goes to sleep.
+#define SURVEY_LISTEN_MS 500
+
+// supply current estimates in uA for the survey report, typical
+// datasheet figures at 3.3V
+#define CUR_MCU_ACTIVE_UA     8000
+#define CUR_MCU_SLEEP_UA      2       // power down
+#define CUR_MCU_WDT_UA        6       // power down with the watchdog running
+#define CUR_RADIO_RX_UA       18500
+#define CUR_RADIO_WUT_UA      1       // sleep with the wake up timer on
+#define CUR_RADIO_SDN_UA      0
+#define CUR_GPS_ON_UA         25000
+#define CUR_GPS_PERIODIC_UA   5000    // 3 s tracking, 12 s standby
+#define CUR_GPS_STANDBY_UA    200
+
+static scan_t benchBuf[BENCH_CHUNK];
+static int16_t scanBuf[SCAN_CHUNK];
+static int16_t bgBuf[BG_SCAN_SZ];
+static uint8_t sweepLevel[SWEEP_SZ];
+static sweep_t sweep = {0, 0, 0, SWEEP_SZ, sweepLevel};
+static uint8_t wfLevel[WF_SZ];
+static uint32_t wfTime[WF_ROWS];
+static waterfall_t wf;
+static bool wfRun, wfZip;
+static trigger_t trig;
+static bool gpsRaw;
+static sdlog_t sdLog;
+// the codecs' previous sweeps and the sweep us times share the RAM.
+// "sweep ... us" isn't taken while the log or a coded waterfall runs.
+static union
+{
+  struct
+  {
+    uint8_t log[SWEEP_SZ];
+    uint8_t zip[SWEEP_SZ];
+  } prev;
+  uint16_t binUs[SWEEP_SZ];
+} scratch;
+static codec_t logCodec, zipCodec;
+static frame_t frame;
+static bool binOut;
+static uint32_t baudRate = HOST_BAUD, baudOld;
+static unsigned long baudSwitched;
+static bool baudPending;
+static byte gpsCfg;
+
+// survey state
+static bool svRun, svDeep, svAsleep;
+static uint32_t svInterval, svCount, svSleepMs, svSlept;
+static unsigned long svListen;
+static uint32_t bgStart;
+static unsigned long bgT0;
+static uint16_t bgStep;
+
+// streaming sweep output position in the current chunk
+static const int16_t *streamDb;
+static uint32_t streamStart;
+static uint16_t streamCnt, streamPos, streamStep;
 
 // this is for printf
 static FILE uartout = {0};  
@@ -14,6 +88,7 @@ static FILE uartout = {0};
 int sdCsPin = 10;
 int radioCsPin = 30;
 int radioSdnPin = 31;
+int radioIrq = 2;   // external interrupt the radio nIRQ line is wired to
 
 SdFat sd;
 SdFile myFile;
@@ -30,29 +105,47 @@ void setup()
   // The uart is the standard output device STDOUT.
   stdout = &uartout ;
   
-  // init radio chip select
-  pinMode(radioCsPin, OUTPUT);
-  digitalWrite(radioCsPin, HIGH);
-  
-  // init radio shutdown pin
-  pinMode(radioSdnPin, OUTPUT);
-  digitalWrite(radioSdnPin, LOW);
-  
-  chibiCmdInit(57600); 
-  Serial1.begin(9600); // gps
+  chibiCmdInit(HOST_BAUD); 
+  txq.begin(&Serial);
   
   chibiCmdAdd("rd", cmdRadioRead);
   chibiCmdAdd("wr", cmdRadioWrite);
   chibiCmdAdd("test", cmdTest);
   chibiCmdAdd("scan", cmdScan);
-  
-  // initialize SPI:
-  SPI.begin(); 
+  chibiCmdAdd("scank", cmdScanKhz);
+  chibiCmdAdd("bg", cmdBgScan);
+  chibiCmdAdd("stream", cmdStream);
+  chibiCmdAdd("sweep", cmdSweep);
+  chibiCmdAdd("zoom", cmdZoom);
+  chibiCmdAdd("wf", cmdWaterfall);
+  chibiCmdAdd("mon", cmdMonitor);
+  chibiCmdAdd("survey", cmdSurvey);
+  chibiCmdAdd("gps", cmdGps);
+  chibiCmdAdd("time", cmdTime);
+  chibiCmdAdd("log", cmdLog);
+  chibiCmdAdd("out", cmdOut);
+  chibiCmdAdd("baud", cmdBaud);
+  chibiCmdAdd("bench", cmdBench);
+  chibiCmdAdd("settle", cmdSettle);
+  chibiCmdAdd("rbw", cmdRbw);
+  chibiCmdAdd("cal", cmdCal);
   
   //////////////////////////////////////////
   // begin initialization display
   //////////////////////////////////////////
-  radioInit();
+  // init radio and gps. this also brings up the SPI bus.
+  // with GPS_UART the gps module drives USART1 itself and Serial1 must
+  // stay out of the build
+#if GPS_UART
+  ascii32.begin(radioCsPin, radioSdnPin, NULL);
+#else
+  ascii32.begin(radioCsPin, radioSdnPin, &Serial1);
+#endif
+  ascii32.radioSetScanIdle(scanIdle);
+  ascii32.gpsBegin(9600);
+  ascii32.gpsConfig();
+  waterfall_init(&wf, wfLevel, WF_SZ, wfTime, WF_ROWS);
+  frame_init(&frame, &txq);
   
   welcomeMsg();
 }
@@ -63,13 +156,38 @@ void setup()
 /*********************************************************************/
 void loop()
 {
-  chibiCmdPoll();
+  // the shell writes to Serial itself, so the queue is drained and held
+  // while it runs. it only writes when there's input to echo.
+  if (Serial.available())
+  {
+    txq.hold();
+    chibiCmdPoll();
+    txq.release();
+  }
+  baudPoll();
   
-  // print gps data if available
-  if (Serial1.available())
+  // advance any background or streaming scan, and write out one point
+  // of streaming output per pass so the radio keeps sweeping meanwhile
+  ascii32.sweepPoll();
+  streamOut();
+  waterfallPoll();
+  surveyPoll();
+  
+  // keep the fix current, or echo the raw sentences if asked to
+  if (!gpsRaw)
+  {
+    ascii32.gpsUpdate();
+    gpsConfigPoll();
+  }
+  else if (ascii32.gpsRxAvail())
   {
-    char c = Serial1.read();
-    Serial.print(c);
+    char c = ascii32.gpsRxRead();
+    txq.print(c);
+  }
+  
+  if (ascii32.monitorBusy())
+  {
+    monitorPoll();
   }
 }
 
@@ -81,221 +199,1233 @@ void welcomeMsg()
 { 
   uint8_t type, ver;
   
-  printf("ASCII-32 Geotagging Sub-1 GHz Spectrum Scanner\n");
-  printf("Last Updated: %s\n\n", DATECODE);
+  printf_P(PSTR("ASCII-32 Geotagging Sub-1 GHz Spectrum Scanner\n"));
+  printf_P(PSTR("Last Updated: %S\n\n"), PSTR(DATECODE));
   
   // check radio device type
-  type = radioRead(SI4313_DEVTYPE);
+  type = ascii32.radioReadReg(SI4313_DEVTYPE);
   if (type == SI4313_TYPE)
   {
-    printf("Silicon Labs SI4313 radio receiver detected.\n");
+    printf_P(PSTR("Silicon Labs SI4313 radio receiver detected.\n"));
     
     // check radio version  
-    ver = radioRead(SI4313_VERSION);
+    ver = ascii32.radioReadReg(SI4313_VERSION);
     if (ver == SI4313_B1VER)
     {
-      printf("Hardware version: B1\n");
+      printf_P(PSTR("Hardware version: B1\n"));
     }
     else
     {
-      printf("Unknown hardware version.\n");
+      printf_P(PSTR("Unknown hardware version.\n"));
     }
   }
   else
   {
-    printf("Unknown radio receiver detected.\n");
+    printf_P(PSTR("Unknown radio receiver detected.\n"));
   }  
   
   // init the SD card
   if (!sd.begin(sdCsPin)) 
   {
-    Serial.println("Card failed, or not present");
+    txq.println("Card failed, or not present");
+    txq.flush();
     sd.initErrorHalt();
     return;
   }
-  printf("SD Card detected and initialized.\n");
+  printf_P(PSTR("SD Card detected and initialized.\n"));
 }
 
 /*********************************************************************/
 //
 //
 /*********************************************************************/
-void radioInit()
+void cmdRadioRead(int arg_cnt, char **args)
 {
-  uint8_t intpStatus[2];
+  uint8_t val, addr;
   
-  // clear radio interrupt regs
-  radioRead(SI4313_INTPSTAT1);
-  radioRead(SI4313_INTPSTAT2);
+  addr = chibiCmdStr2Num(args[1], 16);
+  val = ascii32.radioReadReg(addr);
+  printf_P(PSTR("Addr %02X = %02X.\n"), addr, val);
+}
+
+/*********************************************************************/
+//
+//
+/*********************************************************************/
+void cmdRadioWrite(int arg_cnt, char **args)
+{
+  uint8_t val, addr;
   
-  // issue sw reset
-  radioWrite(SI4313_CONTROL1, 1<<BIT_SWRES);
+  addr = chibiCmdStr2Num(args[1], 16);
+  val = chibiCmdStr2Num(args[2], 16);
+  printf_P(PSTR("Addr %02X = %02X.\n"), addr, val);
+}
+
+/*********************************************************************/
+//
+//
+/*********************************************************************/
+void cmdTest(int arg_cnt, char **args)
+{
+  uint16_t freq;
+  uint8_t val;
+  
+  freq = chibiCmdStr2Num(args[1], 10);
+  ascii32.radioChangeFreq(freq);
   
-  // wait for power on reset status flag to be set
-  while (!(radioRead(SI4313_INTPSTAT2) & (1<<BIT_IPOR)));
+  val = ascii32.radioGetRssi();
+  printf_P(PSTR("Rssi: %d\n"), val);
+}
+
+/*********************************************************************/
+// Print the gps fix as "gps, <utc s>, <lat>, <lon>, <alt cm>, <speed>,
+// <course>, <quality>, <sats>, <valid>". lat/lon are in 1e-7 degrees,
+// speed in 0.01 knots and course in 0.01 degrees. "raw" echoes the
+// NMEA sentences instead of parsing them, "fix" goes back to parsing.
+// "stats" prints and clears the receive counters: bytes dropped with
+// the buffer full, uart overruns and the most bytes ever waiting.
+// "config" switches the gps to 115200 baud, RMC+GGA at 10 Hz. It's also
+// done at startup, the result is printed once the gps has acked.
+// usage: gps [raw | fix | stats | config]
+/*********************************************************************/
+void cmdGps(int arg_cnt, char **args)
+{
+  gps_rx_stats_t st;
   
-  // clear intp regs
-  radioRead(SI4313_INTPSTAT2);
+  if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stats")) == 0))
+  {
+    ascii32.gpsRxStats(&st, true);
+    printf_P(PSTR("GPS rx: %u dropped, %u overrun, %u of %u bytes peak.\n"), st.dropped, st.overrun, st.peak, GPS_RX_BUF_SZ);
+    return;
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("config")) == 0))
+  {
+    gpsRaw = false;
+    ascii32.gpsConfig();
+    return;
+  }
+  else if (arg_cnt > 1)
+  {
+    gpsRaw = (strcmp_P(args[1], PSTR("raw")) == 0);
+    return;
+  }
+  printGps();
+}
+
+/*********************************************************************/
+// Keep parsing the gps while a blocking sweep has the loop. Raw mode
+// echoes from the loop instead.
+/*********************************************************************/
+void scanIdle()
+{
+  if (!gpsRaw)
+    ascii32.gpsUpdate();
+}
+
+/*********************************************************************/
+// Report the gps configuration once it finishes
+/*********************************************************************/
+void gpsConfigPoll()
+{
+  byte state = ascii32.gpsConfigState();
   
-  // wait for chip ready indicator
-  while (!(radioRead(SI4313_INTPSTAT2) & (1<<BIT_ICHIPRDY)));
+  if (state == gpsCfg)
+    return;
+  gpsCfg = state;
   
-  // clear intp regs
-  radioRead(SI4313_INTPSTAT2);
+  if (state == GPS_CFG_DONE)
+    printf_P(PSTR("GPS config, %lu baud, RMC+GGA, 10 Hz.\n"), (unsigned long)GPS_CFG_BAUD);
+  else if (state == GPS_CFG_FAILED)
+    printf_P(PSTR("GPS config failed.\n"));
+}
+
+/*********************************************************************/
+// Timebase status: "time, <source>, <utc now>, <clock error ppm>,
+// <last edge error us>, <edges>". The timebase follows the PPS output on
+// external interrupt <irq> if it's wired, otherwise the arrival of the
+// RMC sentences, which is only good to a few ms.
+// usage: time [pps <irq> | nmea]
+/*********************************************************************/
+void cmdTime(int arg_cnt, char **args)
+{
+  static const char src[][5] PROGMEM = {"none", "nmea", "pps"};
+  timebase_stats_t st;
+  utc_t utc;
   
-  // configure receiver based on excel spreadsheet
-  // FSK, 20ppm tx/rx xtal tolerance, Fc = 905 mhz
-  // bitrate 9.6 kbps, AFC disabled, freq deviation = 70 khz 
-  radioWrite(SI4313_FREQSEL,      0x75);
-  radioWrite(SI4313_FREQCARR1,    0x4B);
-  radioWrite(SI4313_FREQCARR0,    0x00);
-  radioWrite(SI4313_IFBW,         0xAE);
-  radioWrite(SI4313_CLKRATIO,     0x39);
-  radioWrite(SI4313_CLKOFFS2,     0x20);
-  radioWrite(SI4313_CLKOFFS1,     0x68);
-  radioWrite(SI4313_CLKOFFS0,     0xDC);
-  radioWrite(SI4313_CLKLPGAIN1,   0x00);
-  radioWrite(SI4313_CLKLPGAIN0,   0x10);
-  radioWrite(SI4313_AFCOVRD,      0x00);
-  radioWrite(SI4313_AFCCTRL,      0x0A);
-  radioWrite(SI4313_AFCLIMITER,   0x50);
-  radioWrite(SI4313_CLKOVERD,     0x03);
-  radioWrite(SI4313_AGCOVERD1,    0x60);
-  radioWrite(SI4313_PRECTRL,      0x20); // disable rssi adjustment
+  if ((arg_cnt > 2) && (strcmp_P(args[1], PSTR("pps")) == 0))
+    ascii32.timeBegin(chibiCmdStr2Num(args[2], 10));
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("nmea")) == 0))
+    ascii32.timeBegin(TIMEBASE_NO_PPS);
   
-  // enable receiver
-  radioWrite(SI4313_MODCTRL2, 0x02); // enable FSK
-  radioWrite(SI4313_CONTROL1, 0x05); // enable receiver & xtal
+  ascii32.timeStats(&st);
+  ascii32.timeUtc(micros(), &utc);
+  printf_P(PSTR("time, %S, %lu.%06lu, %ld, %ld, %lu\n"), src[st.source], utc.sec, utc.us, 
+         st.ppm16 / 16, st.residual, st.edges);
 }
 
 /*********************************************************************/
-//
-//
+// Geotagged sweep log on the SD card. "start" preallocates <file> as
+// <MB> contiguous megabytes, default LOG_MB, and logs every sweep from
+// then on: waterfall, survey and the sweep command. Each record has the
+// UTC, the gps fix and the levels, delta coded against the sweep before
+// with a keyframe every KEY_EVERY sweeps. With no arguments prints the state
+// and the longest block write, which has to stay under a sweep.
+// "find" and "near" read back a closed log through its index, the
+// sweeps from <from> to <to> s UTC, or within <radius> of <lat>, <lon>,
+// all in 1e-7 degrees. See logQuery for the output.
+// usage: log start <file> [<MB>] | log stop | log |
+//        log find <file> <from s> <to s> [bin] |
+//        log near <file> <lat> <lon> <radius> [bin]
 /*********************************************************************/
-uint8_t radioRead(uint8_t addr)
+void cmdLog(int arg_cnt, char **args)
 {
-  uint8_t val;
-  addr &= ~(1<<7);  // set bit 7 low for read
+  uint32_t mb = LOG_MB;
   
-  cli();
-  digitalWrite(radioCsPin, LOW);
-  val = SPI.transfer(addr); // send address
-  val = SPI.transfer(0);  // receive data
-  digitalWrite(radioCsPin, HIGH);
-  sei();
+  if ((arg_cnt > 4) && (strcmp_P(args[1], PSTR("find")) == 0))
+  {
+    logQuery(arg_cnt, args, false);
+    return;
+  }
+  else if ((arg_cnt > 5) && (strcmp_P(args[1], PSTR("near")) == 0))
+  {
+    logQuery(arg_cnt, args, true);
+    return;
+  }
+  else if ((arg_cnt > 2) && (strcmp_P(args[1], PSTR("start")) == 0))
+  {
+    if (sdLog.open)
+      sdlog_close(&sdLog);
+    if (arg_cnt > 3)
+      mb = chibiCmdStr2Num(args[3], 10);
+    if (!sdlog_open(&sdLog, &sd, args[2], mb * (1048576UL / SDLOG_BLOCK)))
+    {
+      printf_P(PSTR("Log not started.\n"));
+      return;
+    }
+    codec_init(&logCodec, scratch.prev.log, SWEEP_SZ, KEY_EVERY);
+    if (wfRun && (wf.points > WF_SEND_SZ))
+      printf_P(PSTR("Waterfall rows over %u points aren't logged.\n"), WF_SEND_SZ);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    if (sdLog.open && !sdlog_close(&sdLog))
+      printf_P(PSTR("Log close failed.\n"));
+  }
   
-  return val;
+  printf_P(PSTR("Log %S, %lu records, %lu dropped, %lu of %lu blocks, %lu us max write.\n"), 
+         sdLog.open ? (sdLog.failed ? PSTR("failed") : PSTR("open")) : PSTR("closed"), sdLog.hdr.records, sdLog.hdr.dropped, 
+         sdlog_used(&sdLog), sdLog.hdr.blocks, sdLog.maxUs);
 }
 
 /*********************************************************************/
-//
-//
+// Print the sweeps a log query finds. Each is a "rec, <utc>, <sweep us>,
+// <lat>, <lon>, <alt>, <sats>, <valid>" line and the sweep, or in binary
+// a sweep packet with the logged UTC and fix. A "found, <n>" line comes
+// last.
 /*********************************************************************/
-void radioWrite(uint8_t addr, uint8_t data)
+void logQuery(int arg_cnt, char **args, bool near)
 {
-  addr |= (1<<7);  // set bit 7 high for write
+  sdlog_rec_t rec;
+  frame_sweep_t hdr;
+  uint32_t idx, last, n = 0;
+  int32_t lat = 0, lon = 0, radius = 0;
+  bool bin = (strcmp_P(args[arg_cnt - 1], PSTR("bin")) == 0);
   
-  cli();
-  digitalWrite(radioCsPin, LOW);
-  SPI.transfer(addr); // send address
-  SPI.transfer(data);  // receive data
-  digitalWrite(radioCsPin, HIGH);
-  sei();
+  if (!sdlog_load(&sdLog, args[2]))
+  {
+    printf_P(PSTR("Log not found or still open.\n"));
+    return;
+  }
+  
+  if (near)
+  {
+    lat = strtol(args[3], NULL, 10);
+    lon = strtol(args[4], NULL, 10);
+    radius = strtol(args[5], NULL, 10);
+    idx = 0;
+    last = sdLog.hdr.entries;
+  }
+  else
+  {
+    idx = sdlog_find(&sdLog, chibiCmdStr2Num(args[3], 10));
+    last = sdlog_find(&sdLog, chibiCmdStr2Num(args[4], 10) + 1);
+  }
+  
+  for (; idx < last; idx++)
+  {
+    if (near && !sdlog_near(&sdLog, lat, lon, radius, &idx))
+      break;
+    if (!sdlog_read(&sdLog, idx, &rec, &sweep))
+      break;
+    n++;
+    
+    if (bin)
+    {
+      hdr.start = sweep.start;
+      hdr.step = sweep.step;
+      hdr.count = sweep.count;
+      hdr.sec = rec.sec;
+      hdr.us = rec.us;
+      hdr.dur = rec.dur;
+      hdr.lat = rec.lat;
+      hdr.lon = rec.lon;
+      hdr.alt = rec.alt;
+      hdr.sats = rec.sats;
+      hdr.valid = rec.valid;
+      frame_sweep_hdr(&frame, &hdr, sweep.level);
+      continue;
+    }
+    printf_P(PSTR("rec, %lu.%06lu, %lu, %ld, %ld, %ld, %u, %u\n"), rec.sec, rec.us, rec.dur, 
+           rec.lat, rec.lon, rec.alt, rec.sats, rec.valid);
+    sweep_print(&txq, &sweep);
+  }
+  printf_P(PSTR("found, %lu\n"), n);
+  sdlog_unload(&sdLog);
 }
 
 /*********************************************************************/
-//
-//
+// Log a sweep if the log is open and it fits in a record sweep can read back
 /*********************************************************************/
-void cmdRadioRead(int arg_cnt, char **args)
+void logSweep(const sweep_t *sw)
 {
-  uint8_t val, addr;
+  if (sdLog.open && (sw->count <= WF_SEND_SZ))
+    sdlog_sweep(&sdLog, sw, ascii32.gpsFix(), &logCodec);
+}
+
+/*********************************************************************/
+// Output format for scan, scank, bg, stream and sweep. "bin" sends each sweep or chunk of points as one
+// COBS framed packet, see frame.h, instead of a text line per point.
+// Status and error messages stay text.
+// usage: out [text | bin]
+/*********************************************************************/
+void cmdOut(int arg_cnt, char **args)
+{
+  if (arg_cnt > 1)
+    binOut = (strcmp_P(args[1], PSTR("bin")) == 0);
+  printf_P(PSTR("Output %S.\n"), binOut ? PSTR("bin") : PSTR("text"));
+}
+
+/*********************************************************************/
+// Queue <sw> as a sweep packet. If the host link is behind it's
+// dropped and counted rather than holding up the radio.
+/*********************************************************************/
+void sendSweep(const sweep_t *sw)
+{
+  if (txq.reserve(FRAME_SWEEP_SIZE(sw->count)))
+    frame_sweep(&frame, sw, ascii32.gpsFix());
+}
+
+/*********************************************************************/
+// Host link baud rate. "baud <rate>" answers "baud, <rate>" at the old
+// rate and switches, then the host has BAUD_CONFIRM_MS to send "baud ok"
+// at the new one or the link falls back. Rates the clock can't make to
+// within 2% are refused. With no arguments prints the rate and the
+// transmit queue counters: packets dropped, writes that waited for
+// room and the most bytes queued.
+// usage: baud <rate> | baud ok | baud
+/*********************************************************************/
+void cmdBaud(int arg_cnt, char **args)
+{
+  uint32_t rate, real;
   
-  addr = chibiCmdStr2Num(args[1], 16);
-  val = radioRead(addr);
-  printf("Addr %02X = %02X.\n", addr, val);
+  if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("ok")) == 0))
+  {
+    baudPending = false;
+  }
+  else if (arg_cnt > 1)
+  {
+    // same divisor as Serial.begin with double speed
+    rate = chibiCmdStr2Num(args[1], 10);
+    real = (rate < 2000) ? 0 : F_CPU / 8 / ((F_CPU / 4 / rate - 1) / 2 + 1);
+    if ((real == 0) || (labs((long)(real - rate)) * 50 > rate))
+    {
+      printf_P(PSTR("Baud rate not supported.\n"));
+      return;
+    }
+    printf_P(PSTR("baud, %lu\n"), rate);
+    baudSwitch(rate);
+    if (!baudPending)
+    {
+      baudOld = baudRate;
+      baudPending = true;
+    }
+    baudRate = rate;
+    baudSwitched = millis();
+    return;
+  }
+  
+  printf_P(PSTR("Baud %lu%S, %lu dropped, %lu waited, %u peak of %u.\n"), baudRate, baudPending ? PSTR(" unconfirmed") : PSTR(""),
+         txq.drops, txq.waits, txq.peak, TXQ_SZ - 1);
+  txq.clearStats();
 }
 
 /*********************************************************************/
-//
-//
+// Change the host baud rate once everything queued has gone out
 /*********************************************************************/
-void cmdRadioWrite(int arg_cnt, char **args)
+void baudSwitch(uint32_t rate)
 {
-  uint8_t val, addr;
+  // Serial.flush waits for the last byte to leave the shift register
+  txq.flush();
+  Serial.flush();
+  Serial.begin(rate);
+}
+
+/*********************************************************************/
+// Fall back to the last confirmed baud rate if the host never answered
+/*********************************************************************/
+void baudPoll()
+{
+  if (baudPending && (millis() - baudSwitched > BAUD_CONFIRM_MS))
+  {
+    baudPending = false;
+    baudRate = baudOld;
+    baudSwitch(baudRate);
+    printf_P(PSTR("Baud %lu.\n"), baudRate);
+  }
+}
+
+/*********************************************************************/
+// Send <cnt> points in dB from <start> kHz as a sweep packet. <t0> is
+// micros() when the first one was measured.
+/*********************************************************************/
+void sendPoints(uint32_t start, uint16_t step, const int16_t *db, uint16_t cnt, unsigned long t0)
+{
+  sweep_t pts;
+  uint16_t i;
   
-  addr = chibiCmdStr2Num(args[1], 16);
-  val = chibiCmdStr2Num(args[2], 16);
-  printf("Addr %02X = %02X.\n", addr, val);
+  sweep_init(&pts, sweepLevel, SWEEP_SZ);
+  pts.start = start;
+  pts.step = step;
+  pts.count = min(cnt, SWEEP_SZ);
+  for (i=0; i<pts.count; i++)
+    sweepLevel[i] = sweep_level(db[i]);
+  pts.t0 = t0;
+  pts.t1 = micros();
+  sendSweep(&pts);
 }
 
 /*********************************************************************/
-//
-//
+// Print the fix line
 /*********************************************************************/
-void cmdTest(int arg_cnt, char **args)
+void printGps()
 {
-  uint16_t freq, temp, fb, fc;
-  uint8_t val;
+  const gps_fix_t *fix = ascii32.gpsFix();
   
-  freq = chibiCmdStr2Num(args[1], 10);
-  temp = freq - 480;
-  fb = temp/20;  
-  fb |= 0x60;
+  printf_P(PSTR("gps, %lu, %ld, %ld, %ld, %u, %u, %u, %u, %u\n"), fix->time, fix->lat, fix->lon, fix->alt, 
+         fix->speed, fix->course, fix->quality, fix->sats, fix->valid);
+}
+
+/*********************************************************************/
+// Scan 840 to 960 MHz. A gps line comes first to geotag the scan. The optional detector and sample count or dwell
+// time apply to every bin and stay set for later scans.
+// usage: scan [sample|avg|peak|min|rms] [samples] [dwell us]
+/*********************************************************************/
+void cmdScan(int arg_cnt, char **args)
+{
+  uint16_t freq;
+  uint8_t mode, samples = 1;
+  uint16_t dwell = 0;
+  sweep_t pts;
   
-  fc = temp % 20;
-  fc *= 0xC80;
+  if (arg_cnt > 1)
+  {
+    if (strcmp_P(args[1], PSTR("avg")) == 0)
+      mode = DET_AVG;
+    else if (strcmp_P(args[1], PSTR("peak")) == 0)
+      mode = DET_PEAK;
+    else if (strcmp_P(args[1], PSTR("min")) == 0)
+      mode = DET_MIN;
+    else if (strcmp_P(args[1], PSTR("rms")) == 0)
+      mode = DET_RMS;
+    else
+      mode = DET_SAMPLE;
+    
+    if (arg_cnt > 2)
+      samples = chibiCmdStr2Num(args[2], 10);
+    if (arg_cnt > 3)
+      dwell = chibiCmdStr2Num(args[3], 10);
+    ascii32.radioSetDetector(mode, samples, dwell);
+  }
   
-  radioWrite(0x75, fb);
+  if (binOut)
+  {
+    sweep_init(&pts, sweepLevel, SWEEP_SZ);
+    pts.start = 840000;
+    pts.step = 1000;
+    pts.t0 = micros();
+    for (freq=840; freq<960; freq++)
+    {
+      ascii32.radioChangeFreq(freq);
+      sweepLevel[pts.count++] = sweep_level(ascii32.radioMeasure());
+    }
+    pts.t1 = micros();
+    sendSweep(&pts);
+    return;
+  }
   
-  val = fc >> 8;
-  radioWrite(0x76, val);
+  printGps();
+  for (freq=840; freq<960; freq++)
+  {
+    // retune and wait for pll to settle, then run the detector
+    ascii32.radioChangeFreq(freq);
+    printf_P(PSTR("%03d, %d\n"), freq, ascii32.radioMeasure());
+  }
+}
+
+/*********************************************************************/
+// Scan with kHz resolution. Output is one "<kHz>, <dB>" line per point,
+// or a packet per SCAN_CHUNK points with "out bin".
+// usage: scank <start kHz> <stop kHz> <step kHz>
+/*********************************************************************/
+void cmdScanKhz(int arg_cnt, char **args)
+{
+  uint32_t start, stop, freq, cnt, i;
+  uint16_t step;
+  unsigned long t0;
+  
+  if (arg_cnt < 4)
+  {
+    printf_P(PSTR("usage: scank <start kHz> <stop kHz> <step kHz>\n"));
+    return;
+  }
   
-  radioWrite(0x77, fc);
+  start = chibiCmdStr2Num(args[1], 10);
+  stop = chibiCmdStr2Num(args[2], 10);
+  step = chibiCmdStr2Num(args[3], 10);
+  if (step == 0)
+    return;
   
-  val = radioRead(0x26);
-  printf("Rssi: %d\n", val);
+  // scan in chunks that fit the buffer
+  for (freq=start; freq<stop; freq += cnt * step)
+  {
+    t0 = micros();
+    cnt = ascii32.radioScanKhz(freq, stop, step, scanBuf, SCAN_CHUNK);
+    if (cnt == 0)
+      return;
+    
+    if (binOut)
+    {
+      sendPoints(freq, step, scanBuf, cnt, t0);
+      continue;
+    }
+    for (i=0; i<cnt; i++)
+    {
+      printf_P(PSTR("%lu, %d\n"), freq + (i * step), scanBuf[i]);
+    }
+  }
 }
 
 /*********************************************************************/
-//
-//
+// Background scan. Runs from loop() so the shell and gps keep being
+// serviced, and prints the result when it completes.
+// usage: bg <start kHz> <stop kHz> <step kHz> | bg stop | bg
 /*********************************************************************/
-void cmdScan(int arg_cnt, char **args)
+void cmdBgScan(int arg_cnt, char **args)
+{
+  uint32_t stop, cnt;
+  
+  if (arg_cnt > 3)
+  {
+    bgStart = chibiCmdStr2Num(args[1], 10);
+    stop = chibiCmdStr2Num(args[2], 10);
+    bgStep = chibiCmdStr2Num(args[3], 10);
+    
+    // limit the scan to what fits in the buffer
+    if ((bgStep != 0) && (stop > bgStart + ((uint32_t)bgStep * BG_SCAN_SZ)))
+      stop = bgStart + ((uint32_t)bgStep * BG_SCAN_SZ);
+    
+    bgT0 = micros();
+    cnt = ascii32.radioScanStart(bgStart, stop, bgStep, bgBuf, bgScanDone);
+    printf_P(PSTR("Background scan started, %lu points.\n"), cnt);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    ascii32.radioScanStop();
+    printf_P(PSTR("Background scan stopped.\n"));
+  }
+  else
+  {
+    printf_P(PSTR("Background scan %S, %lu points done.\n"), ascii32.radioScanBusy() ? PSTR("running") : PSTR("idle"), ascii32.radioScanProgress());
+  }
+}
+
+/*********************************************************************/
+// Completion callback for the background scan
+/*********************************************************************/
+void bgScanDone(uint32_t count)
+{
+  uint32_t i;
+  
+  if (binOut)
+  {
+    sendPoints(bgStart, bgStep, bgBuf, count, bgT0);
+    return;
+  }
+  for (i=0; i<count; i++)
+  {
+    printf_P(PSTR("%lu, %d\n"), bgStart + (i * bgStep), bgBuf[i]);
+  }
+}
+
+/*********************************************************************/
+// Streaming sweep of any length. Points are printed from loop() while
+// the radio fills the next chunk.
+// usage: stream <start kHz> <stop kHz> <step kHz> | stream stop
+/*********************************************************************/
+void cmdStream(int arg_cnt, char **args)
+{
+  if (arg_cnt > 3)
+  {
+    streamDb = NULL;
+    streamStep = chibiCmdStr2Num(args[3], 10);
+    if (!ascii32.sweepStart(chibiCmdStr2Num(args[1], 10), chibiCmdStr2Num(args[2], 10), streamStep, NULL))
+      printf_P(PSTR("Stream not started.\n"));
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    ascii32.sweepStop();
+    streamDb = NULL;
+  }
+}
+
+/*********************************************************************/
+// Print one point of the streaming sweep, or send a whole chunk as a
+// packet with "out bin"
+/*********************************************************************/
+void streamOut()
 {
-  uint16_t i, j, fb, fc, val, freq;
-  int db;
+  if (!streamDb)
+  {
+    streamDb = ascii32.sweepNext(&streamStart, &streamCnt);
+    streamPos = 0;
+    if (!streamDb)
+      return;
+  }
   
-  for (i=18; i<24; i++)
+  if (binOut)
   {
-    for (j=0; j<20; j++)
+    sendPoints(streamStart, streamStep, streamDb, streamCnt, micros());
+    ascii32.sweepRelease();
+    streamDb = NULL;
+    return;
+  }
+  
+  printf_P(PSTR("%lu, %d\n"), streamStart, streamDb[streamPos]);
+  streamStart += streamStep;
+  
+  if (++streamPos >= streamCnt)
+  {
+    ascii32.sweepRelease();
+    streamDb = NULL;
+  }
+}
+
+/*********************************************************************/
+// Compact sweep, one byte per point. Prints a header line and the
+// levels in hex (0.5 dB steps above -128 dB), or as a sweep packet, see
+// frame.h, with "bin".
+// Text output starts with a "utc, <s>.<us>, <sweep us>" line, the UTC
+// of the first point is 0 until the timebase has synced to the gps.
+// "us" adds the time spent on each point, tuning included, but not
+// while the log or a "z" waterfall is running, they share its RAM. With
+// "out bin" the sweep goes as a packet instead of text.
+// usage: sweep <start kHz> <stop kHz> <step kHz> [bin | us]
+/*********************************************************************/
+void cmdSweep(int arg_cnt, char **args)
+{
+  utc_t utc;
+  bool us;
+  uint16_t i;
+  
+  if (arg_cnt < 4)
+  {
+    printf_P(PSTR("usage: sweep <start kHz> <stop kHz> <step kHz> [bin | us]\n"));
+    return;
+  }
+  
+  us = (arg_cnt > 4) && (strcmp_P(args[4], PSTR("us")) == 0);
+  if (us && (sdLog.open || (wfRun && wfZip)))
+  {
+    printf_P(PSTR("Sweep times not available while logging or sending a waterfall.\n"));
+    return;
+  }
+  sweep.binUs = us ? scratch.binUs : NULL;
+  ascii32.radioScanSweep(chibiCmdStr2Num(args[1], 10), chibiCmdStr2Num(args[2], 10), chibiCmdStr2Num(args[3], 10), &sweep);
+  
+  if ((arg_cnt > 4) && (strcmp_P(args[4], PSTR("bin")) == 0))
+  {
+    frame_sweep(&frame, &sweep, ascii32.gpsFix());
+    return;
+  }
+  
+  logSweep(&sweep);
+  if (binOut)
+  {
+    sendSweep(&sweep);
+    return;
+  }
+  ascii32.timeUtc(sweep.t0, &utc);
+  printf_P(PSTR("utc, %lu.%06lu, %lu\n"), utc.sec, utc.us, sweep.t1 - sweep.t0);
+  sweep_print(&txq, &sweep);
+  if (!us)
+    return;
+  
+  printf_P(PSTR("us"));
+  for (i=0; i<sweep.count; i++)
+  {
+    printf_P(PSTR(", %u"), scratch.binUs[i]);
+    if (((i & 15) == 15) || (i == sweep.count - 1))
+      printf_P(PSTR("\n"));
+  }
+}
+
+/*********************************************************************/
+// Adaptive scan. Coarse pass, then a fine rescan around bins more than
+// <thresh> dB above the noise floor. Prints the merged sweep.
+// usage: zoom <start kHz> <stop kHz> <fine kHz> <coarse kHz> <thresh dB>
+/*********************************************************************/
+void cmdZoom(int arg_cnt, char **args)
+{
+  uint16_t measured;
+  
+  if (arg_cnt < 6)
+  {
+    printf_P(PSTR("usage: zoom <start kHz> <stop kHz> <fine kHz> <coarse kHz> <thresh dB>\n"));
+    return;
+  }
+  
+  measured = ascii32.radioScanAdaptive(chibiCmdStr2Num(args[1], 10), chibiCmdStr2Num(args[2], 10), 
+                                       chibiCmdStr2Num(args[3], 10), chibiCmdStr2Num(args[4], 10), 
+                                       chibiCmdStr2Num(args[5], 10) * 2, &sweep);
+  sweep_print(&txq, &sweep);
+  printf_P(PSTR("Measured %u of %u points.\n"), measured, sweep.count);
+}
+
+/*********************************************************************/
+// Continuous sweep into the waterfall history. Each row is stamped with
+// millis() at the start of its sweep. "wf dump" prints the rows in one
+// burst, all of them or the ones stamped between <from> and <to> ms.
+// "z" also sends each row as it's measured, as a codec packet, see
+// frame.h, mostly deltas against the row before, or as a sweep packet
+// if that's smaller. Rows sent or logged are
+// WF_SEND_SZ points at most.
+// usage: wf <start kHz> <stop kHz> <step kHz> [z] | wf stop | wf clear |
+//        wf dump [<from ms> [<to ms>]] [bin] | wf
+/*********************************************************************/
+void cmdWaterfall(int arg_cnt, char **args)
+{
+  uint32_t start, stop, step, points;
+  bool zip;
+  
+  if (arg_cnt > 3)
+  {
+    start = chibiCmdStr2Num(args[1], 10);
+    stop = chibiCmdStr2Num(args[2], 10);
+    step = chibiCmdStr2Num(args[3], 10);
+    zip = (arg_cnt > 4) && (strcmp_P(args[4], PSTR("z")) == 0);
+    points = ((step == 0) || (stop <= start)) ? 0 : (stop - start + step - 1) / step;
+    wfRun = false;
+    if ((zip || sdLog.open) && (points > WF_SEND_SZ))
+    {
+      printf_P(PSTR("Waterfall not started, %u points at most when sent or logged.\n"), WF_SEND_SZ);
+      return;
+    }
+    if ((points == 0) || (points > 0xFFFF) || !waterfall_config(&wf, start, step, points))
+    {
+      printf_P(PSTR("Waterfall not started.\n"));
+      return;
+    }
+    wfRun = true;
+    wfZip = zip;
+    codec_init(&zipCodec, scratch.prev.zip, SWEEP_SZ, KEY_EVERY);
+    printf_P(PSTR("Waterfall started, %u points, %u rows.\n"), wf.points, wf.depth);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    wfRun = false;
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("clear")) == 0))
+  {
+    waterfall_clear(&wf);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("dump")) == 0))
+  {
+    waterfallDump(arg_cnt - 2, &args[2]);
+  }
+  else
+  {
+    printf_P(PSTR("Waterfall %S, %u of %u rows, %lu sweeps, now %lu ms.\n"), wfRun ? PSTR("running") : PSTR("idle"), 
+           wf.count, wf.depth, wf.total, millis());
+  }
+}
+
+/*********************************************************************/
+// Dump the waterfall rows in a time range. Text is a "waterfall, <rows>"
+// line then a "time, <ms>" line and the sweep for each row. Binary has
+// the same lines but each sweep goes as a sweep packet, see frame.h. The
+// rows don't keep the fix or the sweep time, so those are 0, and the UTC
+// is only filled in for rows the timebase can still convert, up to
+// WF_UTC_MS old.
+/*********************************************************************/
+void waterfallDump(int arg_cnt, char **args)
+{
+  uint32_t from = 0, to = 0xFFFFFFFF, time, age;
+  uint8_t first, last, i;
+  bool bin = false;
+  frame_sweep_t hdr;
+  sweep_t row;
+  utc_t utc;
+  
+  if ((arg_cnt > 0) && (strcmp_P(args[arg_cnt - 1], PSTR("bin")) == 0))
+  {
+    bin = true;
+    arg_cnt--;
+  }
+  if (arg_cnt > 0)
+    from = chibiCmdStr2Num(args[0], 10);
+  if (arg_cnt > 1)
+    to = chibiCmdStr2Num(args[1], 10);
+  
+  first = waterfall_find(&wf, from);
+  last = (to == 0xFFFFFFFF) ? wf.count : waterfall_find(&wf, to + 1);
+  printf_P(PSTR("waterfall, %u\n"), (last > first) ? last - first : 0);
+  
+  for (i=first; i<last; i++)
+  {
+    waterfall_get(&wf, i, &row, &time);
+    printf_P(PSTR("time, %lu\n"), time);
+    if (!bin)
+    {
+      sweep_print(&txq, &row);
+      continue;
+    }
+    
+    age = millis() - time;
+    utc.sec = 0;
+    utc.us = 0;
+    if (age < WF_UTC_MS)
+      ascii32.timeUtc(micros() - (age * 1000UL), &utc);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.start = row.start;
+    hdr.step = row.step;
+    hdr.count = row.count;
+    hdr.sec = utc.sec;
+    hdr.us = utc.us;
+    frame_sweep_hdr(&frame, &hdr, row.level);
+  }
+}
+
+/*********************************************************************/
+// Measure the next waterfall row straight into the ring. Skipped while
+// a background or streaming scan has the radio.
+/*********************************************************************/
+void waterfallPoll()
+{
+  uint32_t time;
+  uint16_t size;
+  sweep_t row;
+  
+  if (!wfRun || ascii32.radioScanBusy())
+    return;
+  
+  sweep_init(&row, waterfall_row(&wf), wf.points);
+  time = millis();
+  if (ascii32.radioScanSweep(wf.start, wf.start + ((uint32_t)wf.points * wf.step), wf.step, &row) != wf.points)
+  {
+    wfRun = false;
+    return;
+  }
+  waterfall_commit(&wf, time);
+  logSweep(&row);
+  
+  if (!wfZip)
+    return;
+  
+  // a row that doesn't fit in the queue isn't coded, so the host's
+  // decoder stays in step with the encoder. a row that codes bigger than
+  // it is goes as a sweep packet and the next one as a keyframe.
+  size = codec_size(&zipCodec, &row);
+  if (size > row.count)
+  {
+    codec_reset(&zipCodec);
+    sendSweep(&row);
+  }
+  else if (txq.reserve(FRAME_CODEC_SIZE(size)))
+  {
+    frame_codec(&frame, &zipCodec, &row);
+  }
+}
+
+/*********************************************************************/
+// Wake on signal monitor. Parks on each channel for <dwell> ms and
+// reports every time the level crosses <thresh> dB, with the time of
+// the radio interrupt in us, the gps fix and the UTC of the interrupt.
+// usage: mon <thresh dB> <dwell ms> <kHz> [<kHz> ...] | mon stop
+/*********************************************************************/
+void cmdMonitor(int arg_cnt, char **args)
+{
+  uint32_t freq[MON_MAX_CHANNELS];
+  uint8_t i, cnt;
+  
+  if (arg_cnt > 3)
+  {
+    cnt = ((arg_cnt - 3) < MON_MAX_CHANNELS) ? arg_cnt - 3 : MON_MAX_CHANNELS;
+    for (i=0; i<cnt; i++)
+    {
+      freq[i] = chibiCmdStr2Num(args[i + 3], 10);
+    }
+    
+    // the monitor needs the receiver to itself
+    wfRun = false;
+    if (ascii32.monitorStart(radioIrq, freq, cnt, strtol(args[1], NULL, 10) * 10, chibiCmdStr2Num(args[2], 10)))
+      printf_P(PSTR("Monitoring %u channels.\n"), cnt);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    ascii32.monitorStop();
+  }
+  else
+  {
+    printf_P(PSTR("usage: mon <thresh dB> <dwell ms> <kHz> [<kHz> ...] | mon stop\n"));
+  }
+}
+
+/*********************************************************************/
+// Print monitor triggers with the gps fix. The MCU idles between
+// events. Any interrupt wakes it: the radio, a uart byte or the millis
+// tick.
+/*********************************************************************/
+void monitorPoll()
+{
+  if (ascii32.monitorPoll(&trig))
+  {
+    printf_P(PSTR("trig, %lu, %lu, %d, %lu, %ld, %ld, %lu, %lu.%06lu\n"), trig.sig.time, trig.sig.freq, trig.sig.db10, 
+           trig.fix.time, trig.fix.lat, trig.fix.lon, trig.gpsAge, trig.utc.sec, trig.utc.us);
+    return;
+  }
+  
+  if (!Serial.available() && !ascii32.gpsRxAvail() && !txq.used())
+  {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+  }
+}
+
+/*********************************************************************/
+// Duty cycled survey. One sweep into the waterfall every <interval> s,
+// asleep in between. The radio's wake up timer wakes the MCU, or with
+// "sdn" the radio is shut down, the gps put in standby and the
+// watchdog wakes the MCU instead. The gps runs in periodic mode
+// otherwise. Each sweep reports the estimated average current over
+// its cycle. "wf dump" reads back the rows, stamped with millis() plus
+// the time spent asleep.
+// usage: survey <start kHz> <stop kHz> <step kHz> <interval s> [sdn] | survey stop
+/*********************************************************************/
+void cmdSurvey(int arg_cnt, char **args)
+{
+  uint32_t start, step;
+  
+  if (arg_cnt > 4)
+  {
+    start = chibiCmdStr2Num(args[1], 10);
+    step = chibiCmdStr2Num(args[3], 10);
+    if ((step == 0) || (chibiCmdStr2Num(args[2], 10) <= start) || 
+        !waterfall_config(&wf, start, step, (chibiCmdStr2Num(args[2], 10) - start + step - 1) / step))
     {
-      fb = i | 0x60;
-      radioWrite(0x75, fb);
-      
-      fc = j * 0xC80;
-      val = fc >> 8;
-      radioWrite(0x76, val);
-      radioWrite(0x77, fc);
-      
-      delay(1); // give some time for pll to tune
-      val = radioRead(0x26);
-      
-      // convert val to db
-      db = map(val, 20, 205, -118, -20);
-      
-      freq = 480 + ((20*i) + j);
-      printf("%03d, %d\n", freq, db);      
+      printf_P(PSTR("Survey not started.\n"));
+      return;
     }
+    
+    wfRun = false;
+    ascii32.monitorStop();
+    svInterval = chibiCmdStr2Num(args[4], 10) * 1000UL;
+    svDeep = (arg_cnt > 5) && (strcmp_P(args[5], PSTR("sdn")) == 0);
+    svCount = 0;
+    svSlept = 0;
+    svAsleep = false;
+    svRun = true;
+    if (!svDeep)
+      ascii32.gpsPeriodic();
+    printf_P(PSTR("Survey started, %u points every %lu s.\n"), wf.points, svInterval / 1000);
+  }
+  else if ((arg_cnt > 1) && (strcmp_P(args[1], PSTR("stop")) == 0))
+  {
+    if (svRun)
+      surveyEnd();
+  }
+  else
+  {
+    printf_P(PSTR("usage: survey <start kHz> <stop kHz> <step kHz> <interval s> [sdn] | survey stop\n"));
   }
 }
 
+/*********************************************************************/
+// Bring the radio and gps back and leave survey mode
+/*********************************************************************/
+void surveyEnd()
+{
+  if (svAsleep)
+    surveyWake();
+  ascii32.gpsNormal();
+  svRun = false;
+}
+
+/*********************************************************************/
+// Bring the radio and gps back up after sleeping
+/*********************************************************************/
+void surveyWake()
+{
+  if (svDeep)
+  {
+    ascii32.radioPowerUp();
+    ascii32.gpsNormal();
+  }
+  else
+  {
+    ascii32.radioWake();
+  }
+  svSlept += svSleepMs;
+  svAsleep = false;
+}
+
+/*********************************************************************/
+// Run the survey schedule from loop(). Sweep, put the radio to sleep,
+// keep the shell up for the listen window, then power down until the
+// next sweep is due.
+/*********************************************************************/
+void surveyPoll()
+{
+  unsigned long t0, sweepUs;
+  uint32_t sweepMs;
+  uint64_t avg;
+  sweep_t row;
+  
+  if (!svRun)
+    return;
+  
+  if (svAsleep)
+  {
+    if ((millis() - svListen) < SURVEY_LISTEN_MS)
+      return;
+    surveySleep();
+    surveyWake();
+  }
+  
+  // sweep straight into the waterfall
+  sweep_init(&row, waterfall_row(&wf), wf.points);
+  t0 = micros();
+  ascii32.radioScanSweep(wf.start, wf.start + ((uint32_t)wf.points * wf.step), wf.step, &row);
+  sweepUs = micros() - t0;
+  waterfall_commit(&wf, millis() + svSlept);
+  logSweep(&row);
+  svCount++;
+  
+  // radio off for the rest of the interval
+  sweepMs = (sweepUs + 999) / 1000;
+  svSleepMs = (svInterval > (sweepMs + SURVEY_LISTEN_MS)) ? svInterval - sweepMs - SURVEY_LISTEN_MS : 0;
+  if (svDeep)
+  {
+    ascii32.radioShutdown();
+    ascii32.gpsStandby();
+  }
+  else
+  {
+    ascii32.radioSleep(svSleepMs + SURVEY_LISTEN_MS, radioIrq);
+  }
+  svAsleep = true;
+  svListen = millis();
+  
+  // average current over the cycle, charge in uA * ms
+  if (svDeep)
+  {
+    avg = (uint64_t)(CUR_MCU_ACTIVE_UA + CUR_RADIO_RX_UA + CUR_GPS_ON_UA) * sweepMs +
+          (uint64_t)(CUR_MCU_ACTIVE_UA + CUR_RADIO_SDN_UA + CUR_GPS_STANDBY_UA) * SURVEY_LISTEN_MS +
+          (uint64_t)(CUR_MCU_WDT_UA + CUR_RADIO_SDN_UA + CUR_GPS_STANDBY_UA) * svSleepMs;
+  }
+  else
+  {
+    avg = (uint64_t)(CUR_MCU_ACTIVE_UA + CUR_RADIO_RX_UA + CUR_GPS_PERIODIC_UA) * sweepMs +
+          (uint64_t)(CUR_MCU_ACTIVE_UA + CUR_RADIO_WUT_UA + CUR_GPS_PERIODIC_UA) * SURVEY_LISTEN_MS +
+          (uint64_t)(CUR_MCU_SLEEP_UA + CUR_RADIO_WUT_UA + CUR_GPS_PERIODIC_UA) * svSleepMs;
+  }
+  avg /= (sweepMs + SURVEY_LISTEN_MS + svSleepMs);
+  
+  printf_P(PSTR("survey, %lu, %lu us, %lu ms asleep, %lu uA avg\n"), svCount, sweepUs, svSleepMs, (uint32_t)avg);
+}
+
+/*********************************************************************/
+// Power down until the survey interval is up. Either the radio wake up
+// timer pulls nIRQ, or the watchdog ticks once a second while the
+// radio is shut down. millis() stops in power down.
+/*********************************************************************/
+void surveySleep()
+{
+  uint32_t ticks;
+  
+  txq.flush();
+  Serial.flush();
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  
+  if (!svDeep)
+  {
+    cli();
+    while (!ascii32.radioWakePending())
+    {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      cli();
+    }
+    sei();
+    return;
+  }
+  
+  // watchdog in interrupt mode, 1 s period
+  MCUSR &= ~(1<<WDRF);
+  cli();
+  WDTCSR = (1<<WDCE) | (1<<WDE);
+  WDTCSR = (1<<WDIE) | (1<<WDP2) | (1<<WDP1);
+  sei();
+  
+  for (ticks = (svSleepMs + 999) / 1000; ticks; ticks--)
+  {
+    sleep_mode();
+  }
+  wdt_disable();
+}
+
+/*********************************************************************/
+// Watchdog wake up for the survey. Nothing to do, waking is the point.
+/*********************************************************************/
+ISR(WDT_vect)
+{
+}
+
+/*********************************************************************/
+// Set the pll settle times in microseconds, SETTLE_MAX_US at most.
+// usage: settle <step us> <band us>
+/*********************************************************************/
+void cmdSettle(int arg_cnt, char **args)
+{
+  uint16_t stepUs, bandUs;
+  
+  if (arg_cnt < 3)
+  {
+    printf_P(PSTR("usage: settle <step us> <band us>\n"));
+    return;
+  }
+  
+  stepUs = min(chibiCmdStr2Num(args[1], 10), SETTLE_MAX_US);
+  bandUs = min(chibiCmdStr2Num(args[2], 10), SETTLE_MAX_US);
+  ascii32.radioSetSettle(stepUs, bandUs);
+  printf_P(PSTR("Settle: step %u us, band %u us.\n"), stepUs, bandUs);
+}
+
+/*********************************************************************/
+// Set the resolution bandwidth in 100 Hz units, or tie it to the scan
+// step size with "auto".
+// usage: rbw [<bw> | auto | off]
+/*********************************************************************/
+void cmdRbw(int arg_cnt, char **args)
+{
+  uint16_t rbw;
+  
+  if (arg_cnt > 1)
+  {
+    if (strcmp_P(args[1], PSTR("auto")) == 0)
+    {
+      ascii32.radioSetAutoRbw(true);
+    }
+    else if (strcmp_P(args[1], PSTR("off")) == 0)
+    {
+      ascii32.radioSetAutoRbw(false);
+    }
+    else
+    {
+      ascii32.radioSetAutoRbw(false);
+      ascii32.radioSetRbw(chibiCmdStr2Num(args[1], 10));
+    }
+  }
+  
+  rbw = ascii32.radioGetRbw();
+  if (rbw == 0)
+    printf_P(PSTR("RBW: default\n"));
+  else
+    printf_P(PSTR("RBW: %u.%u kHz\n"), rbw / 10, rbw % 10);
+}
+
+/*********************************************************************/
+// Per band level calibration. With a reference signal of a known level
+// fed in, "cal <MHz> <tenths of dBm>" corrects the band containing that
+// frequency. Offsets are kept in eeprom once saved.
+// usage: cal [<MHz> <level> | save | clear]
+/*********************************************************************/
+void cmdCal(int arg_cnt, char **args)
+{
+  uint8_t band;
+  int16_t ref;
+  
+  if (arg_cnt > 2)
+  {
+    ref = strtol(args[2], NULL, 10);
+    printf_P(PSTR("Offset: %d\n"), ascii32.radioCalibrate(chibiCmdStr2Num(args[1], 10), ref));
+    return;
+  }
+  else if (arg_cnt > 1)
+  {
+    if (strcmp_P(args[1], PSTR("save")) == 0)
+      ascii32.radioCalSave();
+    else if (strcmp_P(args[1], PSTR("clear")) == 0)
+      ascii32.radioCalClear();
+  }
+  
+  // dump the offsets in 0.5 dB units
+  for (band=0; band<CAL_BANDS; band++)
+  {
+    printf_P(PSTR("%d%c"), ascii32.radioGetCalOffset(band), ((band % 12) == 11) ? '\n' : ' ');
+  }
+}
+
+/*********************************************************************/
+// Time a full scan through the library and report the sweep rate and
+// how many register accesses the shadow cache saved.
+// usage: bench [start MHz] [stop MHz] [hop]
+/*********************************************************************/
+void cmdBench(int arg_cnt, char **args)
+{
+  uint16_t start, stop, freq, next;
+  uint32_t pts = 0, elapsed;
+  unsigned long t0;
+  bool hop;
+  
+  start = (arg_cnt > 1) ? chibiCmdStr2Num(args[1], 10) : 240;
+  stop = (arg_cnt > 2) ? chibiCmdStr2Num(args[2], 10) : 960;
+  hop = (arg_cnt > 3) && (strcmp_P(args[3], PSTR("hop")) == 0);
+  
+  ascii32.radioClearRegsSaved();
+  t0 = micros();
+  for (freq=start; freq<stop; freq=next)
+  {
+    next = ((stop - freq) > BENCH_CHUNK) ? freq + BENCH_CHUNK : stop;
+    if (hop)
+      pts += ascii32.radioScanHop(freq, next, benchBuf);
+    else
+      pts += ascii32.radioScan(freq, next, benchBuf);
+  }
+  elapsed = micros() - t0;
+  
+  if (elapsed == 0)
+    elapsed = 1;
+  printf_P(PSTR("%lu points in %lu us, %lu points/sec\n"), pts, elapsed, (pts * 1000000UL) / elapsed);
+  printf_P(PSTR("%lu register reads and writes skipped by the shadow\n"), ascii32.radioRegsSaved());
+}
 
 /**************************************************************************/
 // This is to implement the printf function from within arduino
 /**************************************************************************/
 static int uart_putchar (char c, FILE *stream)
 {
-    Serial.write(c);
+    txq.write(c);
     return 0;
-}
+}
@@ -29,6 +29,23 @@ int dBIntv = stopDB - startDB;
 
 String[] labels = {"Date: ", "Time: ", "Lat: ", "Lon: "};
 
+// coded sweep packets from "wf ... z", see codec.cpp. they're packets,
+// so binary has to be set to plot them.
+boolean zipValid = false;
+int zipSeq, zipStart, zipStep, zipCount;
+int[] zipLevels = new int[4096];
+
+// packets from "out bin", see frame.h. set to match the scanner.
+boolean binary = false;
+
+// host link rate to switch the scanner to, see cmdBaud. it starts at 57600.
+int linkBaud = 57600;
+byte[] pkt = new byte[8192];
+int pktLen = 0;
+int pktSeq = -1;
+int[] pktLevels = new int[8192];
+long plotNext = -1;
+
 void setup()
 {
   height = 500;
@@ -36,6 +53,10 @@ void setup()
   println(Serial.list());
   size(width, height);
   myPort = new Serial(this, Serial.list()[1], 57600);
+  if (linkBaud != 57600)
+  {
+    linkSwitch();
+  }
   titleFont = loadFont("Garamond-24.vlw");
   dataFont = loadFont("Garamond-18.vlw");
   tickFont = loadFont("Garamond-12.vlw");
@@ -45,7 +66,28 @@ void setup()
 
 void draw()
 {
-  while (myPort.available() > 0)
+  // packets are delimited by zero bytes, anything else between them is
+  // status text and fails the CRC
+  while (binary && (myPort.available() > 0))
+  {
+    int c = myPort.read();
+    if (c != 0)
+    {
+      if (pktLen < pkt.length)
+      {
+        pkt[pktLen] = (byte)c;
+      }
+      pktLen++;
+      continue;
+    }
+    if ((pktLen > 0) && (pktLen <= pkt.length))
+    {
+      packet(cobsDecode(pkt, pktLen));
+    }
+    pktLen = 0;
+  }
+  
+  while (!binary && (myPort.available() > 0))
   {
     String inBuffer = myPort.readStringUntil('\n');
     
@@ -56,27 +98,8 @@ void draw()
        
       if (list[0].equals("gps") == true)
       {
-        //println(list);
-        fill(colors[3], 200);
-        textAlign(LEFT, CENTER);
-        textFont(dataFont);
-        
-        for (int i=1; i<5; i++)
-        {
-          text(labels[i-1], width*graphRightBorder*labelPosition, height*graphTopBorder + (i*textHeight));
-        }
-        
-        // date
-        text(parseDate(list[1]), width*graphRightBorder*textPosition, height*graphTopBorder + (1*textHeight));
-        
-        // time
-        text(parseTime(list[2]), width*graphRightBorder*textPosition, height*graphTopBorder + (2*textHeight));
-        
-        // latitude
-        text(list[3], width*graphRightBorder*textPosition, height*graphTopBorder + (3*textHeight));
-        
-        // longitude
-        text(list[4], width*graphRightBorder*textPosition, height*graphTopBorder + (4*textHeight));   
+        // fix is "gps, <utc s>, <lat>, <lon>, ..." with lat/lon in 1e-7 degrees
+        drawFix(Long.parseLong(list[1]), int(list[2]), int(list[3]));
       }
       else
       {
@@ -88,47 +111,7 @@ void draw()
           oldx = round(width*graphLeftBorder);
           oldy = round(height*graphBottomBorder*0.9);
           
-          // draw title
-          fill(colors[3], 200);
-          textFont(titleFont);
-          textAlign(CENTER);
-          text("ASCII-32 Spectrum Scanning/Mapping", width/2, height*0.05);
-          
-          // draw axes
-          stroke(colors[3], 200);
-          strokeWeight(1);
-          line(width*graphLeftBorder, height*graphBottomBorder, width*graphLeftBorder, height*graphTopBorder); // yaxis
-          line(width*graphLeftBorder, height*graphBottomBorder, width*graphRightBorder, height*graphBottomBorder);
-          
-          // draw axes titles
-          textFont(dataFont);
-          text("Frequency (MHz)", width/2, height*0.99);  
-          
-          pushMatrix();
-          translate(width*0.04, height/2);
-          rotate(-PI/2);        
-          text("Signal Level (dB)", 0, 0);
-          popMatrix();
-          
-          fill(0, 180);
-          textFont(tickFont);
-          textAlign(CENTER, CENTER);
-          
-          // x axis tick marks
-          for (int i=10; i<=freqIntv; i+=50)
-          {
-            float tickX = map(i, 0, freqIntv, width*graphLeftBorder, width*graphRightBorder);
-            line(tickX, height*graphBottomBorder-tickHeight, tickX, height*graphBottomBorder+tickHeight);
-            text(startFreq + i, tickX, height*graphBottomBorder+4*tickHeight);
-          }
-          
-          // y axis tick marks
-          for (int i=10; i<=dBIntv; i+=10)
-          {
-              float tickY = map(i, 0, dBIntv, height*graphBottomBorder, height*graphTopBorder);
-              line(width*graphLeftBorder-tickWidth, tickY, width*graphLeftBorder+tickWidth, tickY);
-              text(startDB + i, width*graphLeftBorder-4*tickWidth, tickY);
-          }
+          drawAxes();
         }
         
         x = round(map(nums[0], startFreq, stopFreq, width*graphLeftBorder, width * graphRightBorder));
@@ -144,21 +127,284 @@ void draw()
   }
 }
 
-String parseDate(String dateIn)
+void drawAxes()
+{
+  // draw title
+  fill(colors[3], 200);
+  textFont(titleFont);
+  textAlign(CENTER);
+  text("ASCII-32 Spectrum Scanning/Mapping", width/2, height*0.05);
+  
+  // draw axes
+  stroke(colors[3], 200);
+  strokeWeight(1);
+  line(width*graphLeftBorder, height*graphBottomBorder, width*graphLeftBorder, height*graphTopBorder); // yaxis
+  line(width*graphLeftBorder, height*graphBottomBorder, width*graphRightBorder, height*graphBottomBorder);
+  
+  // draw axes titles
+  textFont(dataFont);
+  text("Frequency (MHz)", width/2, height*0.99);  
+  
+  pushMatrix();
+  translate(width*0.04, height/2);
+  rotate(-PI/2);        
+  text("Signal Level (dB)", 0, 0);
+  popMatrix();
+  
+  fill(0, 180);
+  textFont(tickFont);
+  textAlign(CENTER, CENTER);
+  
+  // x axis tick marks
+  for (int i=10; i<=freqIntv; i+=50)
+  {
+    float tickX = map(i, 0, freqIntv, width*graphLeftBorder, width*graphRightBorder);
+    line(tickX, height*graphBottomBorder-tickHeight, tickX, height*graphBottomBorder+tickHeight);
+    text(startFreq + i, tickX, height*graphBottomBorder+4*tickHeight);
+  }
+  
+  // y axis tick marks
+  for (int i=10; i<=dBIntv; i+=10)
+  {
+      float tickY = map(i, 0, dBIntv, height*graphBottomBorder, height*graphTopBorder);
+      line(width*graphLeftBorder-tickWidth, tickY, width*graphLeftBorder+tickWidth, tickY);
+      text(startDB + i, width*graphLeftBorder-4*tickWidth, tickY);
+  }
+}
+
+void drawFix(long utc, int lat, int lon)
+{
+  fill(colors[3], 200);
+  textAlign(LEFT, CENTER);
+  textFont(dataFont);
+  
+  for (int i=1; i<5; i++)
+  {
+    text(labels[i-1], width*graphRightBorder*labelPosition, height*graphTopBorder + (i*textHeight));
+  }
+  
+  // date
+  text(formatUtc(utc, "MM/dd/yyyy"), width*graphRightBorder*textPosition, height*graphTopBorder + (1*textHeight));
+  
+  // time
+  text(formatUtc(utc, "HH:mm:ss"), width*graphRightBorder*textPosition, height*graphTopBorder + (2*textHeight));
+  
+  // latitude
+  text(nf(lat / 1e7, 0, 5), width*graphRightBorder*textPosition, height*graphTopBorder + (3*textHeight));
+  
+  // longitude
+  text(nf(lon / 1e7, 0, 5), width*graphRightBorder*textPosition, height*graphTopBorder + (4*textHeight));   
+}
+
+void drawLevels(long start, int step, int[] levels, int count)
 {
-  // expects date in DDMMYY
-  String day, month, year;
-  day = dateIn.substring(0, 2);
-  month = dateIn.substring(2, 4);
-  year = dateIn.substring(4, 6);
-  return (month + "/" + day + "/" + "20" + year);  
+  // levels are 0.5 dB steps above -128 dB, frequencies in kHz. points
+  // that don't carry on from the last ones start a new plot.
+  if (start != plotNext)
+  {
+    background(colors[0]);
+    drawAxes();
+  }
+  stroke(colors[1], 200);
+  strokeWeight(2);
+  for (int i=0; i<count; i++)
+  {
+    x = round(map((start + (float)i * step) / 1000, startFreq, stopFreq, width*graphLeftBorder, width * graphRightBorder));
+    y = round(map(levels[i] / 2.0 - 128, -120, 0, height * graphBottomBorder, height*graphTopBorder));
+    if ((i > 0) || (start == plotNext))
+    {
+      line(oldx, oldy, x, y);
+    }
+    oldx = x;
+    oldy = y;
+  }
+  plotNext = start + (long)count * step;
 }
 
-String parseTime(String timeIn)
+boolean zipDecode(byte[] frame)
 {
-  String hour, minute, second;
-  hour = timeIn.substring(0, 2);
-  minute = timeIn.substring(2, 4);
-  second = timeIn.substring(4, 6);
-  return (hour + ":" + minute + ":" + second);
-}
+  // flags, seq, count, [start, step on keyframes], then varint tokens:
+  // even is a zig-zag level difference, odd a run of unchanged points.
+  // keyframes difference against the point before, the rest against
+  // the last sweep.
+  int pos = 0;
+  if ((frame.length < 4) || (((frame[0] & 1) != 0) && (frame.length < 10)))
+  {
+    zipValid = false;
+    return false;
+  }
+  int flags = frame[pos++] & 0xFF;
+  int seq = frame[pos++] & 0xFF;
+  int count = (frame[pos++] & 0xFF) | ((frame[pos++] & 0xFF) << 8);
+  boolean key = (flags & 1) != 0;
+  
+  if (key)
+  {
+    zipStart = (frame[pos++] & 0xFF) | ((frame[pos++] & 0xFF) << 8) | ((frame[pos++] & 0xFF) << 16) | ((frame[pos++] & 0xFF) << 24);
+    zipStep = (frame[pos++] & 0xFF) | ((frame[pos++] & 0xFF) << 8);
+  }
+  else if (!zipValid || (seq != ((zipSeq + 1) & 0xFF)) || (count != zipCount))
+  {
+    // missed a frame, wait for the next keyframe
+    zipValid = false;
+    return false;
+  }
+  if (count > zipLevels.length)
+  {
+    zipValid = false;
+    return false;
+  }
+  
+  int i = 0;
+  while (i < count)
+  {
+    int tok = 0;
+    int shift = 0;
+    int b;
+    do
+    {
+      if (pos >= frame.length)
+      {
+        zipValid = false;
+        return false;
+      }
+      b = frame[pos++] & 0xFF;
+      tok |= (b & 0x7F) << shift;
+      shift += 7;
+    } while ((b & 0x80) != 0);
+    
+    if ((tok & 1) != 0)
+    {
+      int run = min((tok >> 1) + 1, count - i);
+      for (; run > 0; run--, i++)
+      {
+        if (key)
+        {
+          zipLevels[i] = (i > 0) ? zipLevels[i - 1] : 0;
+        }
+      }
+      continue;
+    }
+    
+    tok >>= 1;
+    int d = (tok >>> 1) ^ -(tok & 1);
+    int ref = key ? ((i > 0) ? zipLevels[i - 1] : 0) : zipLevels[i];
+    zipLevels[i++] = (ref + d) & 0xFF;
+  }
+  
+  zipSeq = seq;
+  zipCount = count;
+  zipValid = true;
+  return true;
+}
+
+byte[] cobsDecode(byte[] in, int len)
+{
+  // each block is a length code and code - 1 bytes, with a zero after
+  // it unless the code is 255 or it's the last block
+  byte[] out = new byte[len];
+  int n = 0;
+  int i = 0;
+  while (i < len)
+  {
+    int code = in[i++] & 0xFF;
+    if (i + code - 1 > len)
+    {
+      return null;
+    }
+    for (int k=1; k<code; k++)
+    {
+      out[n++] = in[i++];
+    }
+    if ((code != 0xFF) && (i < len))
+    {
+      out[n++] = 0;
+    }
+  }
+  return subset(out, 0, n);
+}
+
+int crc16(byte[] data, int len)
+{
+  // CCITT, 0xFFFF start, as frame_crc()
+  int crc = 0xFFFF;
+  for (int i=0; i<len; i++)
+  {
+    int x = ((crc >> 8) ^ data[i]) & 0xFF;
+    x ^= x >> 4;
+    crc = ((crc << 8) ^ (x << 12) ^ (x << 5) ^ x) & 0xFFFF;
+  }
+  return crc;
+}
+
+int getU16(byte[] b, int pos)
+{
+  return (b[pos] & 0xFF) | ((b[pos + 1] & 0xFF) << 8);
+}
+
+int getI32(byte[] b, int pos)
+{
+  return getU16(b, pos) | (getU16(b, pos + 2) << 16);
+}
+
+void packet(byte[] p)
+{
+  // type, seq, payload, crc
+  if ((p == null) || (p.length < 4) || (crc16(p, p.length - 2) != getU16(p, p.length - 2)))
+  {
+    return;
+  }
+  int seq = p[1] & 0xFF;
+  if ((pktSeq >= 0) && (seq != ((pktSeq + 1) & 0xFF)))
+  {
+    println("Missed " + ((seq - pktSeq - 1) & 0xFF) + " packets.");
+  }
+  pktSeq = seq;
+  
+  // FRAME_SWEEP: start, step, count, sec, us, dur, lat, lon, alt, sats, valid, levels
+  if ((p[0] == 1) && (p.length >= 2 + 34 + 2))
+  {
+    long start = getI32(p, 2) & 0xFFFFFFFFL;
+    int step = getU16(p, 6);
+    int count = getU16(p, 8);
+    long sec = getI32(p, 10) & 0xFFFFFFFFL;
+    if ((p.length != 2 + 34 + count + 2) || (count > pktLevels.length))
+    {
+      return;
+    }
+    for (int i=0; i<count; i++)
+    {
+      pktLevels[i] = p[36 + i] & 0xFF;
+    }
+    drawLevels(start, step, pktLevels, count);
+    if (p[35] != 0)
+    {
+      drawFix(sec, getI32(p, 22), getI32(p, 26));
+    }
+  }
+  
+  // FRAME_CODEC: a codec frame
+  if ((p[0] == 2) && zipDecode(subset(p, 2, p.length - 4)))
+  {
+    drawLevels(zipStart, zipStep, zipLevels, zipCount);
+  }
+}
+
+void linkSwitch()
+{
+  // ask at the old rate, then confirm at the new one before the scanner
+  // gives up and falls back
+  myPort.write("baud " + linkBaud + "\r");
+  delay(500);
+  myPort.stop();
+  myPort = new Serial(this, Serial.list()[1], linkBaud);
+  myPort.write("baud ok\r");
+}
+
+String formatUtc(long utc, String pattern)
+{
+  // utc is in seconds since 1970
+  java.text.SimpleDateFormat fmt = new java.text.SimpleDateFormat(pattern);
+  fmt.setTimeZone(java.util.TimeZone.getTimeZone("UTC"));
+  return fmt.format(new java.util.Date(utc * 1000L));
+}